@@ -43,9 +43,9 @@
  *       pressed, go to 'menu' mode. This is where just one LED is lit at a time
  *       starting at the right. Each press of the left button moves the lit
  *       LED to the left as long as the right button is held down. When the right
- *       button is released, then that 'slot' (or 'program') gets run.
- *   - Slot 1: (Right red)
- *   - Slot 2: (Right green)
+ *       button is released, then that 'slot' (or 'program') gets run. (done)
+ *   - Slot 1: (Right red) Secondary display
+ *   - Slot 2: (Right green) Switch the LED scan mode
  */
 
 #include "mcc_generated_files/mcc.h"
@@ -53,11 +53,58 @@
 // Starting time, in ms, between switching which LED is currently on in main pattern
 #define SLOW_DELAY          250
 
-// Maximum number of patterns allowed in the battery array
-#define NUMBER_OF_PATTERNS    8
+/* Every pattern, each with a slot in the pattern arrays. Adding one here
+ * sizes the arrays for it. The pattern program instances (see
+ * PatternInstances[]) come first. There can be at most 8 patterns, one for
+ * each bit of ActivePatterns.
+ */
+enum {
+    PATTERN_RIGHT_FLASH = 0,
+    PATTERN_LEFT_FLASH,
+    NUMBER_OF_INSTANCES,
+    PATTERN_RIGHT_GAME = NUMBER_OF_INSTANCES,
+    PATTERN_MENU,
+    NUMBER_OF_PATTERNS
+};
 
-// Button debounce time in milliseconds
+// Button debounce time in milliseconds. The buttons are sampled
+// DEBOUNCE_SAMPLES times in this long, see DebounceSample().
 #define BUTTON_DEBOUNCE_MS   20
+#define DEBOUNCE_SAMPLES      4
+#define DEBOUNCE_SAMPLE_TICKS (MS_TO_TICKS(BUTTON_DEBOUNCE_MS) / DEBOUNCE_SAMPLES)
+
+// The software timers count in ticks of 125uS, 8 to the millisecond
+#define TICK_US             125
+#define TICKS_PER_MS          8
+#define MS_TO_TICKS(ms)     ((uint16_t)((ms) * TICKS_PER_MS))
+
+// Shortest delay between steps of the flash patterns, in ticks. Faster than
+// this and a step is shorter than an LED's slot in the scan.
+#define FAST_DELAY_TICKS    MS_TO_TICKS(1)
+// Shortest delay between blinks at the end of a flash pattern, in ticks
+#define BLINK_DELAY_TICKS   MS_TO_TICKS(10)
+
+// Software timers run by ServiceTimers(). Each pattern uses the timer with its
+// own pattern index, the rest follow.
+#define TIMER_SHUTDOWN        (NUMBER_OF_PATTERNS + 0)
+#define TIMER_GESTURE         (NUMBER_OF_PATTERNS + 1)
+#define NUMBER_OF_TIMERS      (NUMBER_OF_PATTERNS + 2)
+
+// Main loop tasks, one bit each in ReadyTasks. A task runs when its bit has
+// been set since it last ran.
+#define TASK_TIMERS           0x01  // the ISR has counted ticks
+#define TASK_BUTTONS          0x02  // a button has been debounced up or down, or a
+                                    // hold gesture may have been held long enough
+#define TASK_PATTERNS         0x04  // a pattern program was started or its timer ran out
+#define TASK_GAME             0x08  // a ms went by while the game runs, the right button
+                                    // was pressed, or the game was started or its timer ran out
+#define TASK_MENU             0x10  // a button went up or down, or the menu was started
+// The task that runs each pattern, see PatternTask[]
+#define PATTERN_TASK(p)       (PatternTask[p])
+
+// TimerNext[] values for the end of the list, and for a timer not running
+#define TIMER_NONE            0xFF
+#define TIMER_STOPPED         0xFE
 
 // Number of milliseconds to stay awake for before sleeping just to see if another
 // button will be pressed
@@ -66,6 +113,18 @@
 // Time between two button presses below which is considered 'short'
 #define QUICK_PRESS_MS      250
 
+// Time both buttons have to be held down together to switch the scan mode
+#define LONG_HOLD_MS       2000
+
+// Gesture kinds, see Gestures[]
+#define GESTURE_TAPS          0
+#define GESTURE_HOLD          1
+
+// The game's win celebration: all the LEDs on and off, this many steps of
+// this many milliseconds each
+#define WIN_BLINK_STEPS      10
+#define WIN_BLINK_MS        100
+
 /* Switch inputs :  (pressed = low)
  *   Left = S2 = GP2
  *   Right = S1 = GP3
@@ -116,7 +175,14 @@
  */
 
 #define TRISA_LEDS_ALL_OUTUPT 0xCC
-#define PORTA_LEDS_ALL_LOW    0x00
+#define LATA_LEDS_ALL_LOW     0x00
+
+// Minimum number of instruction cycles all LED pins are held low between
+// one plane and the next (on top of the ISR's own work in between), so no
+// LED can see a part driven pin. 0 for none.
+#ifndef SCAN_BLANK_CYCLES
+#define SCAN_BLANK_CYCLES     0
+#endif
 
 #define LED_R_RED         0x01  // D3 State 1 A0 high
 #define LED_R_GREEN       0x02  // D4 State 0 A1 high
@@ -127,24 +193,118 @@
 #define LED_L_GREEN       0x40  // D6 State 1 A4 high
 #define LED_L_RED         0x80  // D5 State 2 A1 high
 
+#define LEDS_RIGHT        (LED_R_RED | LED_R_GREEN | LED_R_BLUE | LED_R_YELLOW)
+#define LEDS_LEFT         (LED_L_RED | LED_L_GREEN | LED_L_BLUE | LED_L_YELLOW)
+#define LEDS_ALL          (LEDS_RIGHT | LEDS_LEFT)
+
+// Each lit LED gets a scan slot split into 4 bit-angle modulation planes, of
+// 1, 2, 4 and 8 units of TMR0 counts (2uS each). Every slot lasts 15 units of
+// BAM_UNIT_MAX_COUNTS (960uS, 8 units being one full TMR0 period), but each
+// colour has its own, shorter unit from the dwell table below, and the slot
+// ends with a dark tail. BAM_UNIT_COUNTS is the shortest unit the ISR keeps
+// up with when it only scans and counts ticks. The button sample makes it
+// longer than that, so it is held over to a period of at least
+// SAMPLE_MIN_COUNTS, which is never a plane 0 (that includes the slot start).
+#define BAM_PLANES            4
+#define BAM_UNIT_COUNTS      20
+#define BAM_UNIT_MAX_COUNTS  32
+#define SAMPLE_MIN_COUNTS    (2 * BAM_UNIT_COUNTS)
+
+// BAM unit (dwell) for each colour, in TMR0 counts, meant to make the colours
+// look equally bright on a coin cell. These are provisional : they only give
+// blue and green the most time and red and yellow less, on the general
+// expectation that blue and green are the dimmer LEDs on a coin cell, and
+// haven't been checked against a real board yet. Must stay between
+// BAM_UNIT_COUNTS and BAM_UNIT_MAX_COUNTS.
+#define DWELL_RED            20
+#define DWELL_YELLOW         22
+#define DWELL_GREEN          28
+#define DWELL_BLUE           32
+
+// Scan modes. In LED mode each lit LED gets its own slot. In group mode all
+// the lit LEDs that share a high (anode) pin are sunk together in one slot,
+// which on this board is at most 4 slots of 2 LEDs.
+#define SCAN_MODE_LED         0
+#define SCAN_MODE_GROUP       1
+
+// Scan mode used from power up, see SetScanMode()
+#ifndef SCAN_MODE_DEFAULT
+#define SCAN_MODE_DEFAULT     SCAN_MODE_LED
+#endif
+
+// How bright (in percent) each of two LEDs sharing one high pin is, compared
+// to one LED lit on its own. An LED alone in its group is dimmed to match.
+#define GROUP_SHARE_PERCENT  70
+
+// The reloads used when no LEDs are lit : 124uS while a pattern is running
+// (so its steps stay close to on time), and the longest TMR0 period (512uS)
+// when nothing is going on
+#define TMR0_IDLE_RELOAD    (256 - 62)
+#define TMR0_SLOW_RELOAD    0
+
 #define PATTERN_OFF_STATE     0 // State for all patterns where they are inactive
 
-// Index for each pattern into the patterns arrays
-#define PATTERN_RIGHT_FLASH   0
-#define PATTERN_LEFT_FLASH    1
-#define PATTERN_RIGHT_GAME    2
+// Buttons a pattern instance can follow
+#define BUTTON_RIGHT          0
+#define BUTTON_LEFT           1
+#define NUMBER_OF_BUTTONS     2
+
+// The PORTA pins the buttons are on (low when pressed), which are also their
+// lanes in the debouncer
+#define BUTTON_PIN_RIGHT      0x08  // RA3
+#define BUTTON_PIN_LEFT       0x04  // RA2
+#define BUTTON_PINS           (BUTTON_PIN_RIGHT | BUTTON_PIN_LEFT)
+
+// Input events, see PushInput(). Bit 0 is whether the button went down.
+#define INPUT_EDGE(button, down)  ((uint8_t)(((button) << 1) | ((down) ? 1 : 0)))
+#define INPUT_BUTTON(event)       ((uint8_t)((event) >> 1))
+#define INPUT_DOWN(event)         ((bool)((event) & 1))
+// Events the input ring holds, a power of 2
+#define INPUT_RING_SIZE       8
+
+// The colours in a pattern program frame, mapped onto LEDs by the instance
+#define COLOUR_RED            0x01
+#define COLOUR_GREEN          0x02
+#define COLOUR_BLUE           0x04
+#define COLOUR_YELLOW         0x08
+#define COLOURS_ALL           0x0F
+#define NUMBER_OF_COLOURS     4
+
+// How a pattern's layer goes onto the layers below it, see CommitLEDs()
+#define BLEND_OR              0 // light its LEDs as well
+#define BLEND_OVER            1 // replace everything inside its mask
+#define BLEND_XOR             2 // flip its LEDs
+
+/* Pattern program instructions, see RunPattern(). Each one is an opcode byte
+ * and an argument byte, and jumps go to an instruction number.
+ *   P_FRAME(colours)   show the instance's LEDs of those colours (COLOUR_*),
+ *                      then wait the pattern's delay
+ *   P_JUMP(n)          carry on from instruction n
+ *   P_IF_RELEASED(n)   carry on from instruction n if the pattern's button
+ *                      is up
+ *   P_SPEEDUP(ramp)    shorten the delay by the ramp and skip the next
+ *                      instruction, or if the delay is already down to the
+ *                      ramp's floor, set it back to SLOW_DELAY and don't skip
+ *   P_END()            turn the pattern's LEDs off and stop the pattern
+ */
+#define OP_FRAME              0
+#define OP_JUMP               1
+#define OP_IF_RELEASED        2
+#define OP_SPEEDUP            3
+#define OP_END                4
+
+#define P_FRAME(colours)      OP_FRAME, (colours)
+#define P_JUMP(n)             OP_JUMP, (n)
+#define P_IF_RELEASED(n)      OP_IF_RELEASED, (n)
+#define P_SPEEDUP(ramp)       OP_SPEEDUP, (ramp)
+#define P_END()               OP_END, 0
 
-// Maximum number of milliseconds to allow system to run
-#define MAX_AWAKE_TIME_MS     (5UL * 60UL * 1000UL)
+// Speed ramps for P_SPEEDUP
+#define RAMP_MARCH            0 // 80% per step, down to FAST_DELAY_TICKS
+#define RAMP_BLINK            1 // 95% per step, down to BLINK_DELAY_TICKS
 
-// The five states a button can be in (for debouncing))
-typedef enum {
-    BUTTON_STATE_IDLE = 0,
-    BUTTON_STATE_PRESSED_TIMING,
-    BUTTON_STATE_PRESSED,
-    BUTTON_STATE_RELEASED_TIMING,
-    BUTTON_STATE_RELEASED
-} ButtonState_t;
+// Maximum number of seconds to allow system to run
+#define MAX_AWAKE_TIME_S      (5 * 60)
 
 static uint8_t TRISTable[] =
 {
@@ -170,707 +330,1378 @@ static uint8_t PORTTable[] =
   0x02      // Left Red
 };
 
-// Each bit represents an LED. Set high to turn that LED on. Interface from mainline to ISR
-static volatile uint8_t LEDOns = 0;
-// Counts up from 0 to 7, represents the LED number currently being serviced in the ISR
-static uint8_t LEDState = 0;
+static const uint8_t LEDDwell[] =
+{
+  DWELL_RED,        // Right Red
+  DWELL_GREEN,      // Right Green
+  DWELL_BLUE,       // Right Blue
+  DWELL_YELLOW,     // Right Yellow
+  DWELL_YELLOW,     // Left Yellow
+  DWELL_BLUE,       // Left Blue
+  DWELL_GREEN,      // Left Green
+  DWELL_RED         // Left Red
+};
 
-// Each pattern has a delay counter that counts down at a 1ms rate
-volatile uint16_t PatternDelay[NUMBER_OF_PATTERNS];
-// Each pattern has a state variable defining what state it is in
-volatile uint8_t PatternState[NUMBER_OF_PATTERNS];
+// 4 bit level for an LED alone in its group, so it matches one that is sharing
+#define GROUP_ALONE(l)  (((l) * GROUP_SHARE_PERCENT + 50) / 100)
+static const uint8_t GroupAloneLevel[16] =
+{
+  GROUP_ALONE(0),  GROUP_ALONE(1),  GROUP_ALONE(2),  GROUP_ALONE(3),
+  GROUP_ALONE(4),  GROUP_ALONE(5),  GROUP_ALONE(6),  GROUP_ALONE(7),
+  GROUP_ALONE(8),  GROUP_ALONE(9),  GROUP_ALONE(10), GROUP_ALONE(11),
+  GROUP_ALONE(12), GROUP_ALONE(13), GROUP_ALONE(14), GROUP_ALONE(15)
+};
 
-// Counts number of milliseconds we are awake for, and puts us to sleep if 
-// we stay awake for too long
-volatile static uint32_t WakeTimer = 0;
+/* Speed ramps : the delay between frames at each step of a ramp, in ticks.
+ * Step n is SLOW_DELAY times the ramp's percentage to the power n, worked
+ * out by the compiler, and never less than the ramp's floor. Step 0 is
+ * SLOW_DELAY in every ramp. A ramp is over at its first step at or below
+ * its floor, and its last step is always its floor, so OP_SPEEDUP (which
+ * starts a ramp it switches to from step 0) never steps off the end of its
+ * table.
+ */
+#define POW2_(f)    ((f) * (f))
+#define POW4_(f)    (POW2_(f) * POW2_(f))
+#define POW8_(f)    (POW4_(f) * POW4_(f))
+#define POW16_(f)   (POW8_(f) * POW8_(f))
+#define POW32_(f)   (POW16_(f) * POW16_(f))
+#define RAMP_POWER(f, n)  (((n) & 1 ? (f) : 1.0) * ((n) & 2 ? POW2_(f) : 1.0) * \
+                           ((n) & 4 ? POW4_(f) : 1.0) * ((n) & 8 ? POW8_(f) : 1.0) * \
+                           ((n) & 16 ? POW16_(f) : 1.0) * ((n) & 32 ? POW32_(f) : 1.0))
+#define RAMP_STEP(percent, floor, n) \
+  ((uint16_t)(MS_TO_TICKS(SLOW_DELAY) * RAMP_POWER((percent) / 100.0, n) + 0.5) > (floor) ? \
+   (uint16_t)(MS_TO_TICKS(SLOW_DELAY) * RAMP_POWER((percent) / 100.0, n) + 0.5) : (floor))
+#define RAMP_STEPS_8(r, n)  r(n), r(n + 1), r(n + 2), r(n + 3), \
+                            r(n + 4), r(n + 5), r(n + 6), r(n + 7)
+
+/* Ramp table lengths. So as not to jump to its floor at its last step, a
+ * ramp has to get there on its own by then : SLOW_DELAY * 0.8^31 is under
+ * 1 ms (FAST_DELAY_TICKS) up to a SLOW_DELAY of 1009 ms, and
+ * SLOW_DELAY * 0.95^63 is under 10 ms (BLINK_DELAY_TICKS) up to 253 ms.
+ */
+#define MARCH_RAMP_STEPS    32
+#define BLINK_RAMP_STEPS    64
+#if SLOW_DELAY > 1009
+#error "SLOW_DELAY is too slow for MarchRamp[], make MARCH_RAMP_STEPS longer"
+#endif
+#if SLOW_DELAY > 253
+#error "SLOW_DELAY is too slow for BlinkRamp[], make BLINK_RAMP_STEPS longer"
+#endif
+
+// 80% per step, reaches FAST_DELAY_TICKS at step 25
+#define MARCH_STEP(n)   ((n) == MARCH_RAMP_STEPS - 1 ? FAST_DELAY_TICKS : \
+                         RAMP_STEP(80, FAST_DELAY_TICKS, n))
+static const uint16_t MarchRamp[MARCH_RAMP_STEPS] =
+{
+  RAMP_STEPS_8(MARCH_STEP, 0),  RAMP_STEPS_8(MARCH_STEP, 8),
+  RAMP_STEPS_8(MARCH_STEP, 16), RAMP_STEPS_8(MARCH_STEP, 24)
+};
 
-// Counts down from SHUTDOWN_DELAY_MS after everything is over before we go to sleep
-volatile static uint8_t ShutdownDelayTimer = 0;
+// 95% per step, reaches BLINK_DELAY_TICKS at step 63
+#define BLINK_STEP(n)   ((n) == BLINK_RAMP_STEPS - 1 ? BLINK_DELAY_TICKS : \
+                         RAMP_STEP(95, BLINK_DELAY_TICKS, n))
+static const uint16_t BlinkRamp[BLINK_RAMP_STEPS] =
+{
+  RAMP_STEPS_8(BLINK_STEP, 0),  RAMP_STEPS_8(BLINK_STEP, 8),
+  RAMP_STEPS_8(BLINK_STEP, 16), RAMP_STEPS_8(BLINK_STEP, 24),
+  RAMP_STEPS_8(BLINK_STEP, 32), RAMP_STEPS_8(BLINK_STEP, 40),
+  RAMP_STEPS_8(BLINK_STEP, 48), RAMP_STEPS_8(BLINK_STEP, 56)
+};
 
-// Countdown 1ms timers to  debounce the button inputs
-volatile static uint8_t LeftDebounceTimer = 0;
-volatile static uint8_t RightDebounceTimer = 0;
+// Indexed by RAMP_MARCH/RAMP_BLINK
+static const uint16_t * const RampTable[] = {MarchRamp, BlinkRamp};
+static const uint8_t RampFloor[] = {FAST_DELAY_TICKS, BLINK_DELAY_TICKS};
 
-// Keep track of the state of each button during debounce
-volatile static ButtonState_t LeftButtonState = BUTTON_STATE_IDLE;
-volatile static ButtonState_t RightButtonState = BUTTON_STATE_IDLE;
+/* The flash pattern : march red, green, blue, yellow and back, faster each
+ * time round while the button is held. Once it is going super fast, blink
+ * all four, faster and faster, then start the march over slowly. Letting go
+ * of the button finishes the current step and stops.
+ */
+static const uint8_t FlashProgram[] =
+{
+  P_FRAME(COLOUR_RED),        // 0
+  P_FRAME(COLOUR_GREEN),      // 1  march
+  P_FRAME(COLOUR_BLUE),       // 2
+  P_FRAME(COLOUR_YELLOW),     // 3
+  P_FRAME(COLOUR_BLUE),       // 4
+  P_FRAME(COLOUR_GREEN),      // 5
+  P_IF_RELEASED(18),          // 6
+  P_SPEEDUP(RAMP_MARCH),      // 7
+  P_JUMP(11),                 // 8  march is at full speed, go blink
+  P_FRAME(COLOUR_RED),        // 9
+  P_JUMP(1),                  // 10
+  P_FRAME(COLOUR_RED),        // 11
+  P_FRAME(COLOURS_ALL),       // 12 blink
+  P_IF_RELEASED(20),          // 13
+  P_SPEEDUP(RAMP_BLINK),      // 14
+  P_JUMP(22),                 // 15 blink is at full speed, start over
+  P_FRAME(0),                 // 16
+  P_JUMP(12),                 // 17
+  P_FRAME(COLOUR_RED),        // 18 released while marching
+  P_END(),                    // 19
+  P_FRAME(0),                 // 20 released while blinking
+  P_END(),                    // 21
+  P_FRAME(0),                 // 22
+  P_JUMP(0)                   // 23
+};
 
-// Record the last value of WakeTimer when the button was pushed
-volatile static uint32_t LastRightButtonPressTime = 0;
-volatile static uint32_t LastLeftButtonPressTime = 0;
+/* A pattern program instance : the program, the button it follows, and the
+ * LEDs its red, green, blue and yellow are. Its state and delay live in the
+ * per-pattern arrays at the same index.
+ */
+typedef struct {
+  const uint8_t * Program;
+  uint8_t Button;
+  uint8_t ColourLEDs[NUMBER_OF_COLOURS];
+} PatternInstance_t;
 
-void SetLEDOn(uint8_t LED)
+static const PatternInstance_t PatternInstances[NUMBER_OF_INSTANCES] =
 {
-  LEDOns = (uint8_t)(LEDOns | LED);
-}
+  // Right flash
+  {FlashProgram, BUTTON_RIGHT, {LED_R_RED, LED_R_GREEN, LED_R_BLUE, LED_R_YELLOW}},
+  // Left flash
+  {FlashProgram, BUTTON_LEFT,  {LED_L_RED, LED_L_GREEN, LED_L_BLUE, LED_L_YELLOW}}
+};
 
-void SetLEDOff(uint8_t LED)
+// What the game shows for each number of LEDs lit, 1 to 8
+static const uint8_t GameFrames[] =
 {
-  LEDOns = (uint8_t)(LEDOns & ~LED);
+  LED_R_RED,
+  LED_R_RED | LED_R_GREEN,
+  LED_R_RED | LED_R_GREEN | LED_R_BLUE,
+  LEDS_RIGHT,
+  LEDS_RIGHT | LED_L_YELLOW,
+  LEDS_RIGHT | LED_L_YELLOW | LED_L_BLUE,
+  LEDS_RIGHT | LED_L_YELLOW | LED_L_BLUE | LED_L_GREEN,
+  LEDS_ALL
+};
+
+/* Button gestures, each with a slot in the gesture arrays, matched one input
+ * event at a time by MatchGestures().
+ */
+enum {
+    GESTURE_GAME = 0,
+    GESTURE_MENU,
+    GESTURE_SCAN_MODE,
+    NUMBER_OF_GESTURES
+};
+
+/* Each pattern draws on its own layer, indexed by pattern. A layer only ever
+ * has LEDs inside its mask, and is blended onto the ones before it the way
+ * LayerBlend says, while its pattern is running.
+ */
+static const uint8_t LayerMask[NUMBER_OF_PATTERNS] =
+{
+  LEDS_RIGHT,       // Right flash
+  LEDS_LEFT,        // Left flash
+  LEDS_ALL,         // Game, covers the flashes
+  LEDS_ALL          // Menu, covers everything
+};
+static const uint8_t LayerBlend[NUMBER_OF_PATTERNS] =
+{
+  BLEND_OR,         // Right flash
+  BLEND_OR,         // Left flash
+  BLEND_OVER,       // Game
+  BLEND_OVER        // Menu
+};
+
+// The main loop task each pattern runs in
+static const uint8_t PatternTask[NUMBER_OF_PATTERNS] =
+{
+  TASK_PATTERNS,    // Right flash
+  TASK_PATTERNS,    // Left flash
+  TASK_GAME,        // Game
+  TASK_MENU         // Menu
+};
+
+// The LEDs each pattern has on, one bit per LED. Patterns set these with
+// SetLayer(), then CommitLEDs() blends them into one frame for the ISR.
+static uint8_t LayerLEDs[NUMBER_OF_PATTERNS];
+// Set when a layer has changed since the last CommitLEDs()
+static bool LayersChanged = false;
+// The frame that was last committed, and that the scan list shows
+static uint8_t LEDOns = 0;
+// Brightness of each LED when it is on, 0 to 255, in the same order as LEDOns bits
+static volatile uint8_t LEDBrightness[8] = {255, 255, 255, 255, 255, 255, 255, 255};
+
+// How the scan list is built, SCAN_MODE_LED or SCAN_MODE_GROUP
+static uint8_t ScanMode = SCAN_MODE_DEFAULT;
+
+/* Scan list : one entry per slot, built from TRISTable/PORTTable by
+ * UpdateScanList() whenever LEDOns changes. Each slot has the TRIS and PORT
+ * values that drive its high pin with every other LED pin floating, and up
+ * to two LEDs (A and B) whose low pins get added to TRIS to light them.
+ * B is only used in group mode, and ScanSinkB is 0 when there is no B.
+ */
+static uint8_t ScanTRIS[8];
+static uint8_t ScanPORT[8];
+static uint8_t ScanSinkA[8];
+static uint8_t ScanSinkB[8];
+// LED numbers (LEDOns bits) of A and B, to find their brightness
+static uint8_t ScanLEDA[8];
+static uint8_t ScanLEDB[8];
+// BAM unit of each slot, and the dark TMR0 counts that end it (0 for none)
+static uint8_t ScanUnit[8];
+static uint8_t ScanTail[8];
+static volatile uint8_t ScanLength = 0;
+// Index of the scan list entry currently being serviced in the ISR
+static uint8_t ScanSlot = 0;
+// BAM plane currently being shown (0 to 3, or BAM_PLANES for the dark tail),
+// its bit in the levels and its length in TMR0 counts
+static uint8_t ScanPlane = 0;
+static uint8_t PlaneBit = 0x01;
+static uint8_t PlaneCounts = 0;
+// 4 bit levels LED A and B of the current slot are being shown at
+static uint8_t SlotLevelA = 0;
+static uint8_t SlotLevelB = 0;
+// Counts frames from 0 to 15, used to dither in the low 4 brightness bits
+static uint8_t Dither = 0;
+
+// Counts uS of elapsed time (half TMR0 counts), up to one tick's worth
+static uint16_t TimeUs = 0;
+
+// Tasks with work waiting, TASK_* bits. Set by the ISR and the main loop,
+// taken by TakeReadyTasks().
+static volatile uint8_t ReadyTasks = 0;
+
+// Every tick the ISR has counted, to timestamp button events with. Wraps.
+static uint16_t TickCount = 0;
+
+// Ticks the ISR has counted that ServiceTimers() hasn't handled yet
+static volatile uint16_t PendingTicks = 0;
+// Ticks ServiceTimers() has handled towards the next ms of TimeNow
+static uint8_t TickRemainder = 0;
+
+/* Millisecond timebase for deadlines. Only the main loop (ServiceTimers())
+ * moves it on, so reading it needs no care. It is 16 bits and wraps every
+ * 65.5 seconds, so compare times with TIME_REACHED() or by subtracting,
+ * never with < or >, and keep deadlines less than 32.7 seconds away.
+ */
+typedef uint16_t Time_t;
+static Time_t TimeNow = 0;
+
+// True once time Now has reached time Then, across a wrap
+#define TIME_REACHED(Now, Then)   ((int16_t)(Time_t)((Now) - (Then)) >= 0)
+
+// Set by main() while any pattern is running, see UpdateScanRate()
+static bool PatternsRunning = false;
+
+/* Delta list of the running software timers, soonest first. Each timer's
+ * TimerDelta is how many ms it expires after the one before it in the list,
+ * so time passing only ever changes the head of the list, however many
+ * timers are running.
+ */
+static uint16_t TimerDelta[NUMBER_OF_TIMERS];
+static uint8_t TimerNext[NUMBER_OF_TIMERS];
+static uint8_t TimerHead = TIMER_NONE;
+
+// Each pattern has a state variable defining what state it is in. For pattern
+// programs it is the number of the next instruction to run, plus one.
+volatile uint8_t PatternState[NUMBER_OF_PATTERNS];
+// One bit for each pattern that is running, kept by StartPattern()/StopPattern()
+static uint8_t ActivePatterns = 0;
+// Each pattern program's current delay between frames, as the ramp it is on
+// and its step down that ramp
+static uint8_t PatternRamp[NUMBER_OF_PATTERNS];
+static uint8_t PatternStep[NUMBER_OF_PATTERNS];
+
+// Counts number of seconds (and ms towards the next) we are awake for, and
+// puts us to sleep if we stay awake for too long
+static uint16_t WakeSeconds = 0;
+static uint16_t WakeMs = 0;
+
+// Each button's pin, indexed by BUTTON_RIGHT/BUTTON_LEFT
+static const uint8_t ButtonPin[NUMBER_OF_BUTTONS] = {BUTTON_PIN_RIGHT, BUTTON_PIN_LEFT};
+
+/* The debouncer, run by the ISR : the button pins that are debounced down,
+ * the pins that are being timed because they differ from that, and a 2 bit
+ * counter for each pin, its low bits in DebounceCount0 and high bits in
+ * DebounceCount1. Ticks until the next sample.
+ */
+static volatile uint8_t ButtonsDebounced = 0;
+static volatile uint8_t ButtonsChanging = 0;
+static uint8_t DebounceCount0 = 0xFF;
+static uint8_t DebounceCount1 = 0xFF;
+static uint8_t SampleTicks = DEBOUNCE_SAMPLE_TICKS;
+static bool SamplePending = false;
+
+// The button pins that are down, as of the last input event the main loop took
+static uint8_t ButtonsDown = 0;
+
+// Record the time when the button was pushed
+static Time_t LastRightButtonPressTime = 0;
+static Time_t LastLeftButtonPressTime = 0;
+
+// How far each gesture has got (presses so far, or for a hold, 1 once it is
+// being held and 2 once it has matched), and the time of the last event that
+// moved it on. Set while any hold gesture is being held.
+static uint8_t GestureCount[NUMBER_OF_GESTURES];
+static Time_t GestureTime[NUMBER_OF_GESTURES];
+static bool HoldsArmed = false;
+
+/* Input event ring. The debouncer in the ISR is the only thing that adds
+ * events (at InputHead) and the main loop the only thing that takes them
+ * (from InputTail), so each index only ever has one writer and neither side
+ * needs interrupts off. Each event is an INPUT_EDGE() and the tick (in
+ * TickCount) it came at. An event that finds the ring full is dropped and
+ * InputOverflow set instead.
+ */
+static uint8_t InputEvent[INPUT_RING_SIZE];
+static uint16_t InputTick[INPUT_RING_SIZE];
+static volatile uint8_t InputHead = 0;
+static volatile uint8_t InputTail = 0;
+static volatile bool InputOverflow = false;
+
+// Set the LEDs a pattern has on in its layer. LEDs outside its mask are ignored.
+void SetLayer(uint8_t Pattern, uint8_t On)
+{
+  On &= LayerMask[Pattern];
+  if (On != LayerLEDs[Pattern])
+  {
+    LayerLEDs[Pattern] = On;
+    LayersChanged = true;
+  }
 }
 
 void SetAllLEDsOff(void)
 {
-  LEDOns = 0;
+  uint8_t i;
+
+  for (i = 0; i < NUMBER_OF_PATTERNS; i++)
+  {
+    LayerLEDs[i] = 0;
+  }
+  LayersChanged = true;
 }
 
-/* This ISR runs every 125 uS. It takes the values in LEDState and lights
- * up the LEDs appropriately.
- * It also handles a number of software timer decrementing every 1ms.
- */
-void TMR0_Callback(void)
+// Start a pattern from the top, or over again if it is already running
+void StartPattern(uint8_t Pattern)
+{
+  PatternState[Pattern] = 1;
+  ActivePatterns |= (uint8_t)(1 << Pattern);
+  LayersChanged = true;
+  ReadyTasks |= PATTERN_TASK(Pattern);
+}
+
+void StopPattern(uint8_t Pattern)
+{
+  PatternState[Pattern] = PATTERN_OFF_STATE;
+  ActivePatterns &= (uint8_t)~(1 << Pattern);
+  LayersChanged = true;
+}
+
+// Set the brightness (0 to 255) that one or more LEDs will have when on
+void SetLEDBrightness(uint8_t LED, uint8_t Brightness)
 {
   uint8_t i;
-    
-  // Default all LEDs to be off
-  TRISA = TRISA_LEDS_ALL_OUTUPT;
-  PORTA = PORTA_LEDS_ALL_LOW;
 
-  // Create local bit pattern to test for what LED we should be thinking about
-  i = (uint8_t)(1 << LEDState);
-  
-  // If the bit in LEDOns we're looking at is high (i.e. LED on)
-  if (i & LEDOns)
+  for (i = 0; i < 8; i++)
   {
-    // Then set the tris and port registers from the tables
-    TRISA = TRISTable[LEDState];
-    PORTA = PORTTable[LEDState];
+    if (LED & 0x01)
+    {
+      LEDBrightness[i] = Brightness;
+    }
+    LED = (uint8_t)(LED >> 1);
   }
+}
 
-  // Always increment state and bit
-  LEDState++;
-  if (LEDState == 8)
+/* Scan rate governor. Picks the TMR0 periods for the scan list as it now
+ * stands, so the ISR only runs as often as the LEDs need:
+ *  - LEDs lit : BAM planes from each slot's unit, see LEDDwell[]
+ *  - no LEDs lit, a pattern running : TMR0_IDLE_RELOAD
+ *  - no LEDs lit, nothing running : TMR0_SLOW_RELOAD
+ * The ISR counts the length of every period it loads, so the 1ms timers
+ * stay right whichever is in use. Call with TMR0IE off.
+ */
+static void UpdateScanRate(void)
+{
+  if (ScanLength)
+  {
+    PlaneCounts = ScanUnit[0];
+    timer0ReloadVal = (uint8_t)(0 - PlaneCounts);
+  }
+  else if (PatternsRunning)
+  {
+    timer0ReloadVal = TMR0_IDLE_RELOAD;
+  }
+  else
   {
-    // Approximately 1ms has passed since last time LEDState was 0, so
-    // perform the 1ms tasks
+    timer0ReloadVal = TMR0_SLOW_RELOAD;
+  }
+}
+
+/* Rebuild the scan list from LEDOns. The ISR then only ever cycles through
+ * LEDs that are lit, so each slot gets 1/n of the time rather than 1/8 (n
+ * being the number of slots).
+ */
+void UpdateScanList(void)
+{
+  uint8_t leds = LEDOns;
+  uint8_t i;
+  uint8_t slot;
+  uint8_t sink;
+  uint8_t length = 0;
 
-    // Always increment wake timer to count this millisecond
-    WakeTimer++;
+  // Keep the ISR from using a half written entry
+  INTCONbits.TMR0IE = 0;
 
-    // Handle time delays for patterns
-    for (i=0; i < 8; i++)
+  for (i = 0; i < 8; i++)
+  {
+    if (leds & 0x01)
     {
-      if (PatternDelay[i])
+      // The low pin is whichever of the LED's two driven pins isn't high
+      sink = (uint8_t)(~TRISTable[i] & ~PORTTable[i] & 0x33);
+
+      // In group mode, look for a slot already driving the same high pin
+      slot = length;
+      if (ScanMode == SCAN_MODE_GROUP)
       {
-        PatternDelay[i]--;
+        for (slot = 0; slot < length; slot++)
+        {
+          if (ScanPORT[slot] == PORTTable[i])
+          {
+            break;
+          }
+        }
       }
-    }
 
-    LEDState = 0;
+      if (slot == length)
+      {
+        ScanTRIS[slot] = (uint8_t)(TRISTable[i] | sink);
+        ScanPORT[slot] = PORTTable[i];
+        ScanSinkA[slot] = sink;
+        ScanSinkB[slot] = 0;
+        ScanLEDA[slot] = i;
+        ScanUnit[slot] = LEDDwell[i];
+        length++;
+      }
+      else
+      {
+        ScanSinkB[slot] = sink;
+        ScanLEDB[slot] = i;
+        // Two LEDs in one slot get the longer of their two dwells
+        if (LEDDwell[i] > ScanUnit[slot])
+        {
+          ScanUnit[slot] = LEDDwell[i];
+        }
+      }
+    }
+    leds = (uint8_t)(leds >> 1);
+  }
 
-    // Decrement button debounce timers
-    if (LeftDebounceTimer)
+  // Pad every slot out to the same length, unless the tail would be too short
+  // for the ISR
+  for (slot = 0; slot < length; slot++)
+  {
+    ScanTail[slot] = (uint8_t)(15 * (BAM_UNIT_MAX_COUNTS - ScanUnit[slot]));
+    if (ScanTail[slot] < BAM_UNIT_COUNTS)
     {
-        LeftDebounceTimer--;
+      ScanTail[slot] = 0;
     }
+  }
+  ScanLength = length;
+  ScanSlot = 0;
+  ScanPlane = 0;
+  PlaneBit = 0x01;
+  UpdateScanRate();
+
+  INTCONbits.TMR0IE = 1;
+}
+
+/* Blend the layers of the running patterns, bottom (pattern 0) first, and
+ * show the result on the LEDs. The main loop calls this once all of the
+ * patterns have had their turn, so the ISR never sees half a step, and the
+ * scan list is only rebuilt when the blended frame changes.
+ */
+void CommitLEDs(void)
+{
+  uint8_t i;
+  uint8_t Active;
+  uint8_t Frame = 0;
 
-    if (RightDebounceTimer)
+  if (!LayersChanged)
+  {
+    return;
+  }
+  LayersChanged = false;
+
+  for (i = 0, Active = ActivePatterns; Active; i++, Active >>= 1)
+  {
+    if (!(Active & 1))
     {
-        RightDebounceTimer--;
+      continue;
     }
-    
-    if (ShutdownDelayTimer)
+    switch (LayerBlend[i])
     {
-      ShutdownDelayTimer--;
+      case BLEND_OVER:
+        Frame = (uint8_t)((Frame & ~LayerMask[i]) | LayerLEDs[i]);
+        break;
+
+      case BLEND_XOR:
+        Frame ^= LayerLEDs[i];
+        break;
+
+      default:
+        Frame |= LayerLEDs[i];
+        break;
     }
   }
+
+  if (Frame != LEDOns)
+  {
+    LEDOns = Frame;
+    UpdateScanList();
+  }
 }
 
-// Return the raw state of the right button input
-bool RightButtonPressedRaw(void)
+// Tell the scan rate governor whether any pattern is running
+void SetPatternsRunning(bool Running)
 {
-  return (uint8_t)(PORTAbits.RA3 == 0);
+  if (Running != PatternsRunning)
+  {
+    PatternsRunning = Running;
+    INTCONbits.TMR0IE = 0;
+    UpdateScanRate();
+    INTCONbits.TMR0IE = 1;
+  }
 }
 
-// Return the raw state of the left button input
-bool LeftButtonPressedRaw(void)
+// Switch between SCAN_MODE_LED and SCAN_MODE_GROUP
+void SetScanMode(uint8_t Mode)
 {
-  return (uint8_t)(PORTAbits.RA2 == 0);
+  ScanMode = Mode;
+  UpdateScanList();
 }
 
-// Return the logical (debounced) state of the right button
-bool RightButtonPressed(void)
+// Work out the 4 bit level to show an LED at for this frame
+static uint8_t LEDLevel(uint8_t LED)
 {
-    return (RightButtonState == BUTTON_STATE_PRESSED);
+  uint8_t brightness = LEDBrightness[LED];
+  uint8_t level = (uint8_t)(brightness >> 4);
+
+  if ((uint8_t)(brightness & 0x0F) > Dither && level != 0x0F)
+  {
+    level++;
+  }
+  return level;
 }
 
-// Return the logical (debounced) state of the left button
-bool LeftButtonPressed(void)
+/* Add an input event to the ring, from the ISR. TickCount has already
+ * counted the whole TMR0 period now running, so the ticks still to come in
+ * it (a tick being 64 counts, near enough) are taken off the event's time.
+ * The event is written before InputHead moves on to cover it.
+ */
+static void PushInput(uint8_t Event)
 {
-    return (LeftButtonState == BUTTON_STATE_PRESSED);
+  uint8_t head = InputHead;
+  uint8_t next = (uint8_t)((head + 1) & (INPUT_RING_SIZE - 1));
+
+  if (next == InputTail)
+  {
+    InputOverflow = true;
+  }
+  else
+  {
+    InputEvent[head] = Event;
+    InputTick[head] = (uint16_t)(TickCount - ((uint8_t)(0 - TMR0) >> 6));
+    InputHead = next;
+  }
+  ReadyTasks |= TASK_BUTTONS;
 }
 
-void RunRightFlash(void)
+/* Take one sample of the button pins, from the ISR. Each pin is a bit lane
+ * of a vertical counter : every lane's 2 bit counter goes round while its
+ * pin differs from its debounced state, and starts over whenever it
+ * doesn't, so the debounced state only flips once the pin has differed for
+ * DEBOUNCE_SAMPLES samples in a row. The whole byte is done at once, so
+ * more inputs would cost nothing more.
+ */
+static void DebounceSample(void)
 {
-  static uint16_t right_delay = SLOW_DELAY;
+  uint8_t i;
+  uint8_t changed = (uint8_t)((~PORTA & BUTTON_PINS) ^ ButtonsDebounced);
 
-  if (PatternDelay[PATTERN_RIGHT_FLASH] == 0)
+  DebounceCount0 = (uint8_t)~(DebounceCount0 & changed);
+  DebounceCount1 = (uint8_t)(DebounceCount0 ^ (DebounceCount1 & changed));
+  ButtonsChanging = changed;
+  changed &= (uint8_t)(DebounceCount0 & DebounceCount1);
+  if (changed)
   {
-    switch(PatternState[PATTERN_RIGHT_FLASH])
+    ButtonsDebounced ^= changed;
+    ButtonsChanging &= (uint8_t)~changed;
+    for (i = 0; i < NUMBER_OF_BUTTONS; i++)
     {
-      case 0:
-        // Do nothing, this pattern inactive
-        right_delay = SLOW_DELAY;
-        break;
-
-      case 1:
-        SetLEDOn(LED_R_RED);
-        SetLEDOff(LED_R_GREEN);
-        SetLEDOff(LED_R_BLUE);
-        SetLEDOff(LED_R_YELLOW);
-        break;
-
-      case 2:
-        SetLEDOff(LED_R_RED);
-        SetLEDOn(LED_R_GREEN);
-        SetLEDOff(LED_R_BLUE);
-        SetLEDOff(LED_R_YELLOW);
-        break;
-
-      case 3:
-        SetLEDOff(LED_R_RED);
-        SetLEDOff(LED_R_GREEN);
-        SetLEDOn(LED_R_BLUE);
-        SetLEDOff(LED_R_YELLOW);
-        break;
-
-      case 4:
-        SetLEDOff(LED_R_RED);
-        SetLEDOff(LED_R_GREEN);
-        SetLEDOff(LED_R_BLUE);
-        SetLEDOn(LED_R_YELLOW);
-        break;
-
-      case 5:
-        SetLEDOff(LED_R_RED);
-        SetLEDOff(LED_R_GREEN);
-        SetLEDOn(LED_R_BLUE);
-        SetLEDOff(LED_R_YELLOW);
-        break;
+      if (changed & ButtonPin[i])
+      {
+        PushInput(INPUT_EDGE(i, ButtonsDebounced & ButtonPin[i]));
+      }
+    }
+  }
+}
 
-      case 6:
-        SetLEDOff(LED_R_RED);
-        SetLEDOn(LED_R_GREEN);
-        SetLEDOff(LED_R_BLUE);
-        SetLEDOff(LED_R_YELLOW);
-        break;
+/* This ISR shows one BAM plane of the current slot in the scan list (if any
+ * are lit), and sets the length of the next period through TMR0's reload.
+ * The planes are 1, 2, 4 and 8 units long (40 to 64uS a unit, see LEDDwell[]),
+ * so each LED is lit for as many units of its slot as the top 4 bits of its
+ * brightness. Slots with a short unit then stay dark for their tail. The low 4
+ * bits are dithered in over 16 frames.
+ * It also counts off 125uS ticks for ServiceTimers().
+ */
+void TMR0_Callback(void)
+{
+  uint8_t i;
+  uint8_t period;
+    
+  // Default all LEDs to be off. The latch goes low before any pin is made an
+  // output, or the last high pin would light every LED it can reach.
+  LATA = LATA_LEDS_ALL_LOW;
+  TRISA = TRISA_LEDS_ALL_OUTUPT;
 
-      case 7:
-        SetLEDOn(LED_R_RED);
-        SetLEDOff(LED_R_GREEN);
-        SetLEDOff(LED_R_BLUE);
-        SetLEDOff(LED_R_YELLOW);
-        break;
+  // TMR0_ISR() has just loaded the length of the period now starting
+  period = (uint8_t)(0 - timer0ReloadVal);
+  TimeUs += (uint16_t)period << 1;
+  if (period == 0)
+  {
+    // A reload of 0 is a whole 256 count period
+    TimeUs += 512;
+  }
 
-      case 8:
-        SetLEDOn(LED_R_RED);
-        SetLEDOn(LED_R_GREEN);
-        SetLEDOn(LED_R_BLUE);
-        SetLEDOn(LED_R_YELLOW);
-        break;
+  if (ScanLength)
+  {
+    if (ScanPlane == 0)
+    {
+      // New slot, so work out what levels to show its LEDs at this frame
+      SlotLevelA = LEDLevel(ScanLEDA[ScanSlot]);
+      SlotLevelB = 0;
+      if (ScanSinkB[ScanSlot])
+      {
+        SlotLevelB = LEDLevel(ScanLEDB[ScanSlot]);
+      }
+      else if (ScanMode == SCAN_MODE_GROUP)
+      {
+        SlotLevelA = GroupAloneLevel[SlotLevelA];
+      }
+    }
 
-      case 9:
-        SetLEDOff(LED_R_RED);
-        SetLEDOff(LED_R_GREEN);
-        SetLEDOff(LED_R_BLUE);
-        SetLEDOff(LED_R_YELLOW);
-        break;
+    // Sink each LED that is lit in this plane
+    i = ScanTRIS[ScanSlot];
+    if (SlotLevelA & PlaneBit)
+    {
+      i = (uint8_t)(i & ~ScanSinkA[ScanSlot]);
+    }
+    if (SlotLevelB & PlaneBit)
+    {
+      i = (uint8_t)(i & ~ScanSinkB[ScanSlot]);
+    }
 
-      case 10:
-        SetLEDOff(LED_R_RED);
-        SetLEDOff(LED_R_GREEN);
-        SetLEDOff(LED_R_BLUE);
-        SetLEDOff(LED_R_YELLOW);
-        PatternState[PATTERN_RIGHT_FLASH] = PATTERN_OFF_STATE;
-        break;
-        
-      default:
-        PatternState[PATTERN_RIGHT_FLASH] = 0;
-        break;
+    if (i != ScanTRIS[ScanSlot])
+    {
+#if SCAN_BLANK_CYCLES
+      _delay(SCAN_BLANK_CYCLES);
+#endif
+      // Then set the tris and latch registers from the scan list. TRIS goes
+      // first, so pins that should float stop driving while still low.
+      TRISA = i;
+      LATA = ScanPORT[ScanSlot];
     }
 
-    // Move to the next state
-    if (PatternState[PATTERN_RIGHT_FLASH] != 0)
+    // Move on to the next plane, then the slot's dark tail (which no level
+    // has a bit for), then the next slot
+    ScanPlane++;
+    PlaneBit = (uint8_t)(PlaneBit << 1);
+    if (ScanPlane == BAM_PLANES && ScanTail[ScanSlot])
     {
-      // When we get to state 7, there is a decision to make
-      if (PatternState[PATTERN_RIGHT_FLASH] == 7)
-      {
-        // If the right button is still held down
-        if (RightButtonPressed())
-        {
-          // Then keep going with the pattern
-          if (right_delay > 3)
-          {
-            // If we're not yet going super fast, decrease our delay and
-            // start over at state 2
-            right_delay = ((right_delay * 80)/100);
-            PatternState[PATTERN_RIGHT_FLASH] = 2;
-          }
-          else
-          {
-            // If we're already going super fast, then jump to state 8
-            // and slow things down
-            PatternState[PATTERN_RIGHT_FLASH] = 8;
-            right_delay = SLOW_DELAY;
-          }
-        }
-        else
-        {
-          // Button not pressed, so stop the pattern by shutting off all the LEDs
-          PatternState[PATTERN_RIGHT_FLASH] = 10;
-        }
-      }
-      // Now, if we get to state 9 and the button is still pressed
-      else if ((PatternState[PATTERN_RIGHT_FLASH] == 9) && RightButtonPressed())
+      timer0ReloadVal = (uint8_t)(0 - ScanTail[ScanSlot]);
+    }
+    else
+    {
+      if (ScanPlane >= BAM_PLANES)
       {
-        // Then see if we're not yet going super fast
-        if (right_delay > 10)
-        {
-          // And go a bit faster, jumping back to state 8
-          right_delay = ((right_delay * 95)/100);
-          PatternState[PATTERN_RIGHT_FLASH] = 8;
-        }
-        else
+        ScanPlane = 0;
+        PlaneBit = 0x01;
+        ScanSlot++;
+        if (ScanSlot == ScanLength)
         {
-          // We're already going super fast, so jump back to state 1 to restart
-          // the whole pattern over, nice and slow.
-          PatternState[PATTERN_RIGHT_FLASH] = 1;
-          right_delay = SLOW_DELAY;
+          ScanSlot = 0;
+          Dither = (uint8_t)((Dither + 1) & 0x0F);
         }
+        PlaneCounts = ScanUnit[ScanSlot];
       }
       else
       {
-        // If none of the above applies, then just march on to the next state
-        PatternState[PATTERN_RIGHT_FLASH]++;
+        PlaneCounts = (uint8_t)(PlaneCounts << 1);
       }
-      PatternDelay[PATTERN_RIGHT_FLASH] = right_delay;
+      timer0ReloadVal = (uint8_t)(0 - PlaneCounts);
     }
   }
+
+  // No period is longer than 512uS, so at most four ticks have passed
+  while (TimeUs >= TICK_US)
+  {
+    TimeUs -= TICK_US;
+    PendingTicks++;
+    TickCount++;
+    ReadyTasks |= TASK_TIMERS;
+
+    if (--SampleTicks == 0)
+    {
+      SampleTicks = DEBOUNCE_SAMPLE_TICKS;
+      SamplePending = true;
+    }
+  }
+
+  // Sample the buttons in the first period long enough to fit it (a period
+  // of 0 being 256 counts). That is at most one slot late.
+  if (SamplePending && (uint8_t)(period - 1) >= (uint8_t)(SAMPLE_MIN_COUNTS - 1))
+  {
+    SamplePending = false;
+    DebounceSample();
+  }
 }
 
-void RunLeftFlash(void)
+// Mark every software timer as not running
+void TimersInitialize(void)
 {
-  static uint16_t left_delay = SLOW_DELAY;
-  
-  if (PatternDelay[PATTERN_LEFT_FLASH] == 0)
+  uint8_t i;
+
+  for (i = 0; i < NUMBER_OF_TIMERS; i++)
   {
-    switch(PatternState[PATTERN_LEFT_FLASH])
-    {
-      case 0:
-        // Do nothing, this pattern inactive
-        left_delay = SLOW_DELAY;
-        break;
+    TimerNext[i] = TIMER_STOPPED;
+  }
+  TimerHead = TIMER_NONE;
+}
 
-      case 1:
-        SetLEDOn(LED_L_RED);
-        SetLEDOff(LED_L_GREEN);
-        SetLEDOff(LED_L_BLUE);
-        SetLEDOff(LED_L_YELLOW);
-        break;
+// True from TimerStart() until the timer's time is up
+bool TimerRunning(uint8_t Timer)
+{
+  return (TimerNext[Timer] != TIMER_STOPPED);
+}
 
-      case 2:
-        SetLEDOff(LED_L_RED);
-        SetLEDOn(LED_L_GREEN);
-        SetLEDOff(LED_L_BLUE);
-        SetLEDOff(LED_L_YELLOW);
-        break;
+// Take a timer out of the list without it expiring, handing its delta on to
+// the timer after it
+void TimerStop(uint8_t Timer)
+{
+  uint8_t prev = TIMER_NONE;
+  uint8_t t = TimerHead;
+  uint8_t next = TimerNext[Timer];
 
-      case 3:
-        SetLEDOff(LED_L_RED);
-        SetLEDOff(LED_L_GREEN);
-        SetLEDOn(LED_L_BLUE);
-        SetLEDOff(LED_L_YELLOW);
-        break;
+  if (next == TIMER_STOPPED)
+  {
+    return;
+  }
 
-      case 4:
-        SetLEDOff(LED_L_RED);
-        SetLEDOff(LED_L_GREEN);
-        SetLEDOff(LED_L_BLUE);
-        SetLEDOn(LED_L_YELLOW);
-        break;
+  while (t != Timer)
+  {
+    prev = t;
+    t = TimerNext[t];
+  }
 
-      case 5:
-        SetLEDOff(LED_L_RED);
-        SetLEDOff(LED_L_GREEN);
-        SetLEDOn(LED_L_BLUE);
-        SetLEDOff(LED_L_YELLOW);
-        break;
+  if (next != TIMER_NONE)
+  {
+    TimerDelta[next] += TimerDelta[Timer];
+  }
+  if (prev == TIMER_NONE)
+  {
+    TimerHead = next;
+  }
+  else
+  {
+    TimerNext[prev] = next;
+  }
+  TimerNext[Timer] = TIMER_STOPPED;
+}
 
-      case 6:
-        SetLEDOff(LED_L_RED);
-        SetLEDOn(LED_L_GREEN);
-        SetLEDOff(LED_L_BLUE);
-        SetLEDOff(LED_L_YELLOW);
-        break;
+// (Re)start a timer to run out Ticks ticks from now. 0 just stops it.
+void TimerStart(uint8_t Timer, uint16_t Ticks)
+{
+  uint8_t prev = TIMER_NONE;
+  uint8_t t;
 
-      case 7:
-        SetLEDOn(LED_L_RED);
-        SetLEDOff(LED_L_GREEN);
-        SetLEDOff(LED_L_BLUE);
-        SetLEDOff(LED_L_YELLOW);
-        break;
+  TimerStop(Timer);
+  if (Ticks == 0)
+  {
+    return;
+  }
 
-      case 8:
-        SetLEDOn(LED_L_RED);
-        SetLEDOn(LED_L_GREEN);
-        SetLEDOn(LED_L_BLUE);
-        SetLEDOn(LED_L_YELLOW);
-        break;
+  // Find the first timer that expires after this one, using up our ticks
+  // on the ones before it
+  t = TimerHead;
+  while (t != TIMER_NONE && TimerDelta[t] <= Ticks)
+  {
+    Ticks -= TimerDelta[t];
+    prev = t;
+    t = TimerNext[t];
+  }
 
-      case 9:
-        SetLEDOff(LED_L_RED);
-        SetLEDOff(LED_L_GREEN);
-        SetLEDOff(LED_L_BLUE);
-        SetLEDOff(LED_L_YELLOW);
-        break;
+  TimerDelta[Timer] = Ticks;
+  TimerNext[Timer] = t;
+  if (t != TIMER_NONE)
+  {
+    TimerDelta[t] -= Ticks;
+  }
+  if (prev == TIMER_NONE)
+  {
+    TimerHead = Timer;
+  }
+  else
+  {
+    TimerNext[prev] = Timer;
+  }
+}
 
-      case 10:
-        SetLEDOff(LED_L_RED);
-        SetLEDOff(LED_L_GREEN);
-        SetLEDOff(LED_L_BLUE);
-        SetLEDOff(LED_L_YELLOW);
-        PatternState[PATTERN_LEFT_FLASH] = PATTERN_OFF_STATE;
-        break;
+/* Take the ticks the ISR has counted, as one coherent snapshot. PendingTicks
+ * is two bytes the ISR can change between, so TMR0's interrupt is held off
+ * while it is read and cleared.
+ */
+static uint16_t TakePendingTicks(void)
+{
+  uint16_t ticks;
 
-      default:
-        PatternState[PATTERN_LEFT_FLASH] = 0;
-        break;
+  INTCONbits.TMR0IE = 0;
+  ticks = PendingTicks;
+  PendingTicks = 0;
+  INTCONbits.TMR0IE = 1;
+
+  return ticks;
+}
+
+/* Run the software timers for every tick the ISR has counted since the last
+ * call. Called from the main loop (and anything in it that waits on a
+ * timer), so the ISR takes the same time on every tick.
+ */
+void ServiceTimers(void)
+{
+  uint8_t t;
+  uint16_t ticks = TakePendingTicks();
+  uint16_t ms;
+
+  if (ticks == 0)
+  {
+    return;
+  }
+
+  // Whole milliseconds for the ms timebase
+  ms = (uint16_t)((ticks + TickRemainder) / TICKS_PER_MS);
+  TickRemainder = (uint8_t)((ticks + TickRemainder) % TICKS_PER_MS);
+  TimeNow += ms;
+  if (ms && (ActivePatterns & (1 << PATTERN_RIGHT_GAME)))
+  {
+    // The game works to TimeNow deadlines
+    ReadyTasks |= TASK_GAME;
+  }
+
+  // Always increment wake timer to count these milliseconds
+  WakeMs += ms;
+  while (WakeMs >= 1000)
+  {
+    WakeMs -= 1000;
+    WakeSeconds++;
+  }
+
+  // Expire every timer these ticks reach, and take what is left off the next
+  while (TimerHead != TIMER_NONE)
+  {
+    t = TimerHead;
+    if (TimerDelta[t] > ticks)
+    {
+      TimerDelta[t] -= ticks;
+      break;
     }
+    ticks -= TimerDelta[t];
+    TimerHead = TimerNext[t];
+    TimerNext[t] = TIMER_STOPPED;
 
-    // Move to the next state
-    if (PatternState[PATTERN_LEFT_FLASH] != 0)
+    // Wake up whatever was waiting on it. Only the shutdown wait in main()
+    // polls its timer instead.
+    if (t < NUMBER_OF_PATTERNS)
     {
-      if (PatternState[PATTERN_LEFT_FLASH] == 7)
-      {
-        if (LeftButtonPressed())
+      ReadyTasks |= PATTERN_TASK(t);
+    }
+    else if (t == TIMER_GESTURE)
+    {
+      ReadyTasks |= TASK_BUTTONS;
+    }
+  }
+}
+
+/* Take the tasks that have work waiting, clearing them, as one snapshot
+ * against the interrupts that set them. Returns 0 if there are none.
+ */
+static uint8_t TakeReadyTasks(void)
+{
+  uint8_t ready;
+
+  INTERRUPT_GlobalInterruptDisable();
+  ready = ReadyTasks;
+  ReadyTasks = 0;
+  INTERRUPT_GlobalInterruptEnable();
+
+  return ready;
+}
+
+// Return the logical (debounced) state of BUTTON_RIGHT or BUTTON_LEFT
+bool ButtonPressed(uint8_t Button)
+{
+  return ((ButtonsDown & ButtonPin[Button]) != 0);
+}
+
+// Return the logical (debounced) state of the right button
+bool RightButtonPressed(void)
+{
+  return ButtonPressed(BUTTON_RIGHT);
+}
+
+/* Run a pattern program instance (see P_FRAME() and friends) one step, if
+ * the pattern is on and its timer has run out. Instructions are run until
+ * one shows a frame, which starts the timer again, or ends the pattern.
+ */
+void RunPattern(uint8_t Pattern)
+{
+  const PatternInstance_t * Instance = &PatternInstances[Pattern];
+  const uint8_t * Program = Instance->Program;
+  uint8_t pc;
+  uint8_t arg;
+  uint8_t leds;
+  uint8_t i;
+
+  if (TimerRunning(Pattern))
+  {
+    return;
+  }
+
+  if (PatternState[Pattern] == PATTERN_OFF_STATE)
+  {
+    // Do nothing, this pattern inactive
+    return;
+  }
+
+  pc = (uint8_t)(PatternState[Pattern] - 1);
+  while (1)
+  {
+    arg = Program[2 * pc + 1];
+    switch (Program[2 * pc])
+    {
+      case OP_FRAME:
+        leds = 0;
+        for (i = 0; i < NUMBER_OF_COLOURS; i++)
         {
-          if (left_delay > 3)
+          if (arg & 1)
           {
-            left_delay = ((left_delay * 80)/100);
-            PatternState[PATTERN_LEFT_FLASH] = 2;
-          }
-          else
-          {
-            PatternState[PATTERN_LEFT_FLASH] = 8;
-            left_delay = SLOW_DELAY;
+            leds |= Instance->ColourLEDs[i];
           }
+          arg >>= 1;
         }
-        else
+        SetLayer(Pattern, leds);
+        PatternState[Pattern] = (uint8_t)(pc + 2);
+        TimerStart(Pattern, RampTable[PatternRamp[Pattern]][PatternStep[Pattern]]);
+        return;
+
+      case OP_JUMP:
+        pc = arg;
+        break;
+
+      case OP_IF_RELEASED:
+        pc = ButtonPressed(Instance->Button) ? (uint8_t)(pc + 1) : arg;
+        break;
+
+      case OP_SPEEDUP:
+        // A step only means anything on its own ramp, so a new ramp starts
+        // from step 0. Step 0 is the same in every ramp, so switching ramps
+        // from there carries straight on.
+        if (arg != PatternRamp[Pattern])
         {
-          PatternState[PATTERN_LEFT_FLASH] = 10;
+          PatternRamp[Pattern] = arg;
+          PatternStep[Pattern] = 0;
         }
-      }
-      else if ((PatternState[PATTERN_LEFT_FLASH] == 9) && LeftButtonPressed())
-      {
-        if (left_delay > 10)
+        if (RampTable[arg][PatternStep[Pattern]] > RampFloor[arg])
         {
-          left_delay = ((left_delay * 95)/100);
-          PatternState[PATTERN_LEFT_FLASH] = 8;
+          PatternStep[Pattern]++;
+          pc += 2;
         }
         else
         {
-          PatternState[PATTERN_LEFT_FLASH] = 1;
-          left_delay = SLOW_DELAY;
+          PatternStep[Pattern] = 0;
+          pc++;
         }
-      }
-      else
-      {
-        PatternState[PATTERN_LEFT_FLASH]++;
-      }
-      PatternDelay[PATTERN_LEFT_FLASH] = left_delay;
+        break;
+
+      default:
+        // Finished, so the next press starts slow again
+        PatternRamp[Pattern] = RAMP_MARCH;
+        PatternStep[Pattern] = 0;
+        SetLayer(Pattern, 0);
+        StopPattern(Pattern);
+        return;
     }
   }
 }
 
+// Run every pattern program instance, see RunPattern()
+void RunPatterns(void)
+{
+  uint8_t Pattern;
+
+  for (Pattern = 0; Pattern < NUMBER_OF_INSTANCES; Pattern++)
+  {
+    RunPattern(Pattern);
+  }
+}
+
+// When the game next takes an LED off. StartGame() sets it, since TimeNow
+// carries on across wakes and a stale deadline can be 32 seconds away.
+static Time_t GameDecrementTime = 0;
+
 void RunGame(void)
 {
   static uint8_t num_leds_lit = 1;
-  static uint32_t last_button_press_time = 0;
-  static uint32_t next_decrement_time = 0;
-  
-  if (PatternDelay[PATTERN_RIGHT_GAME] == 0)
+  static Time_t last_button_press_time = 0;
+  // Steps of the win celebration still to show
+  static uint8_t win_blink_steps = 0;
+
+  if (!PatternState[PATTERN_RIGHT_GAME])
+  {
+    return;
+  }
+
+  // Detect new button presses and increment LED count if seen. This keeps
+  // going during the win celebration, so presses then count too.
+  if (last_button_press_time != LastRightButtonPressTime)
   {
-    if (PatternState[PATTERN_RIGHT_GAME])
+    if ((Time_t)(LastRightButtonPressTime - last_button_press_time) < 150)
     {
-      switch(num_leds_lit)
-      {
-        case 0:
-          // Do nothing, this pattern inactive
-          break;
-
-        case 1:
-          SetLEDOn(LED_R_RED);
-          SetLEDOff(LED_R_GREEN);
-          SetLEDOff(LED_R_BLUE);
-          SetLEDOff(LED_R_YELLOW);
-          SetLEDOff(LED_L_YELLOW);
-          SetLEDOff(LED_L_BLUE);
-          SetLEDOff(LED_L_GREEN);
-          SetLEDOff(LED_L_RED);
-          break;
-
-        case 2:
-          SetLEDOn(LED_R_RED);
-          SetLEDOn(LED_R_GREEN);
-          SetLEDOff(LED_R_BLUE);
-          SetLEDOff(LED_R_YELLOW);
-          SetLEDOff(LED_L_YELLOW);
-          SetLEDOff(LED_L_BLUE);
-          SetLEDOff(LED_L_GREEN);
-          SetLEDOff(LED_L_RED);
-          break;
-
-        case 3:
-          SetLEDOn(LED_R_RED);
-          SetLEDOn(LED_R_GREEN);
-          SetLEDOn(LED_R_BLUE);
-          SetLEDOff(LED_R_YELLOW);
-          SetLEDOff(LED_L_YELLOW);
-          SetLEDOff(LED_L_BLUE);
-          SetLEDOff(LED_L_GREEN);
-          SetLEDOff(LED_L_RED);
-          break;
-
-        case 4:
-          SetLEDOn(LED_R_RED);
-          SetLEDOn(LED_R_GREEN);
-          SetLEDOn(LED_R_BLUE);
-          SetLEDOn(LED_R_YELLOW);
-          SetLEDOff(LED_L_YELLOW);
-          SetLEDOff(LED_L_BLUE);
-          SetLEDOff(LED_L_GREEN);
-          SetLEDOff(LED_L_RED);
-          break;
-
-        case 5:
-          SetLEDOn(LED_R_RED);
-          SetLEDOn(LED_R_GREEN);
-          SetLEDOn(LED_R_BLUE);
-          SetLEDOn(LED_R_YELLOW);
-          SetLEDOn(LED_L_YELLOW);
-          SetLEDOff(LED_L_BLUE);
-          SetLEDOff(LED_L_GREEN);
-          SetLEDOff(LED_L_RED);
-          break;
-
-        case 6:
-          SetLEDOn(LED_R_RED);
-          SetLEDOn(LED_R_GREEN);
-          SetLEDOn(LED_R_BLUE);
-          SetLEDOn(LED_R_YELLOW);
-          SetLEDOn(LED_L_YELLOW);
-          SetLEDOn(LED_L_BLUE);
-          SetLEDOff(LED_L_GREEN);
-          SetLEDOff(LED_L_RED);
-          break;
-
-        case 7:
-          SetLEDOn(LED_R_RED);
-          SetLEDOn(LED_R_GREEN);
-          SetLEDOn(LED_R_BLUE);
-          SetLEDOn(LED_R_YELLOW);
-          SetLEDOn(LED_L_YELLOW);
-          SetLEDOn(LED_L_BLUE);
-          SetLEDOn(LED_L_GREEN);
-          SetLEDOff(LED_L_RED);
-          break;
-
-        case 8:
-          SetLEDOn(LED_R_RED);
-          SetLEDOn(LED_R_GREEN);
-          SetLEDOn(LED_R_BLUE);
-          SetLEDOn(LED_R_YELLOW);
-          SetLEDOn(LED_L_YELLOW);
-          SetLEDOn(LED_L_BLUE);
-          SetLEDOn(LED_L_GREEN);
-          SetLEDOn(LED_L_RED);
-          break;
-
-        default:
-          break;
-      }
-      
-      // Detect new button presses and increment LED count if seen
-      if (last_button_press_time != LastRightButtonPressTime)
-      {
-        if (LastRightButtonPressTime < (last_button_press_time + 150))
-        {
-          num_leds_lit++;
-          
-          if (num_leds_lit > 8)
-          {
-            num_leds_lit = 0;
-            
-            SetLEDOn(0xFF);
-            __delay_ms(100);
-            SetLEDOff(0xFF);
-            __delay_ms(100);
-            SetLEDOn(0xFF);
-            __delay_ms(100);
-            SetLEDOff(0xFF);
-            __delay_ms(100);
-            SetLEDOn(0xFF);
-            __delay_ms(100);
-            SetLEDOff(0xFF);
-            __delay_ms(100);
-            SetLEDOn(0xFF);
-            __delay_ms(100);
-            SetLEDOff(0xFF);
-            __delay_ms(100);
-            SetLEDOn(0xFF);
-            __delay_ms(100);
-            SetLEDOff(0xFF);
-            __delay_ms(100);
-          }
-        }
-        last_button_press_time = LastRightButtonPressTime;
-      }
-      
-      // Decrement LED count every so many milliseconds
-      if (WakeTimer > next_decrement_time)
+      num_leds_lit++;
+
+      if (num_leds_lit > 8)
       {
-        next_decrement_time = WakeTimer + 160;
-        if (num_leds_lit)
-        {
-          num_leds_lit--;
-        }
+        num_leds_lit = 0;
+        win_blink_steps = WIN_BLINK_STEPS;
       }
     }
-  }    
-}
+    last_button_press_time = LastRightButtonPressTime;
+  }
 
-// Return true if either button is currently down (raw)
-bool CheckForButtonPushes(void)
-{
-  static bool LastLeftButtonState = false;
-  static bool LastRightButtonState = false;
-  static uint8_t LeftButtonQuickPressCount = 0;
-  
-  // Debounce left button press
-  if (LeftButtonPressedRaw())
+  if (TimerRunning(PATTERN_RIGHT_GAME))
+  {
+    return;
+  }
+
+  // Win celebration : blink all of the LEDs, on first
+  if (win_blink_steps)
   {
-    if (LeftButtonState == BUTTON_STATE_PRESSED_TIMING)
+    SetLayer(PATTERN_RIGHT_GAME, (win_blink_steps & 1) ? 0 : LEDS_ALL);
+    win_blink_steps--;
+    TimerStart(PATTERN_RIGHT_GAME, MS_TO_TICKS(WIN_BLINK_MS));
+    return;
+  }
+
+  // At 0 LEDs, leave whatever was last shown
+  if (num_leds_lit)
+  {
+    SetLayer(PATTERN_RIGHT_GAME, GameFrames[num_leds_lit - 1]);
+  }
+
+  // Decrement LED count every so many milliseconds
+  if (TIME_REACHED(TimeNow, GameDecrementTime))
+  {
+    GameDecrementTime = TimeNow + 160;
+    if (num_leds_lit)
     {
-      if (LeftDebounceTimer == 0)
-      {
-        LeftButtonState = BUTTON_STATE_PRESSED;
-      }
+      num_leds_lit--;
     }
-    else if (LeftButtonState != BUTTON_STATE_PRESSED)
+  }
+}
+
+// Slot programs the menu can start, see Slots[]
+static void StartGame(void)
+{
+  GameDecrementTime = TimeNow;
+  StartPattern(PATTERN_RIGHT_GAME);
+}
+
+static void SwitchScanMode(void)
+{
+  SetScanMode((ScanMode == SCAN_MODE_LED) ? SCAN_MODE_GROUP : SCAN_MODE_LED);
+}
+
+/* The menu's slots, in the order its lit LED walks them, right to left. A
+ * program is added by giving it a row here : the entry point to call when
+ * its slot is picked, and the LED that shows the slot.
+ */
+typedef struct {
+  void (*Start)(void);
+  uint8_t LED;
+} Slot_t;
+
+static const Slot_t Slots[] =
+{
+  {StartGame,      LED_R_RED},    // Slot 1
+  {SwitchScanMode, LED_R_GREEN}   // Slot 2
+};
+
+#define NUMBER_OF_SLOTS       (sizeof(Slots) / sizeof(Slots[0]))
+
+/* Menu : one LED lit at a time, starting at the right. Each left button press
+ * moves it on to the next slot, and letting go of the right button runs the
+ * slot it is on.
+ */
+static uint8_t MenuSlot = 0;
+static Time_t MenuLeftPressTime = 0;
+
+// Open the menu on its first slot. The taps that opened it don't move it on.
+static void StartMenu(void)
+{
+  MenuSlot = 0;
+  MenuLeftPressTime = LastLeftButtonPressTime;
+  StartPattern(PATTERN_MENU);
+}
+
+void RunMenu(void)
+{
+  if (!PatternState[PATTERN_MENU])
+  {
+    return;
+  }
+
+  if (MenuLeftPressTime != LastLeftButtonPressTime)
+  {
+    MenuLeftPressTime = LastLeftButtonPressTime;
+    MenuSlot++;
+    if (MenuSlot == NUMBER_OF_SLOTS)
     {
-      LeftButtonState = BUTTON_STATE_PRESSED_TIMING;
-      LeftDebounceTimer = BUTTON_DEBOUNCE_MS;
+      MenuSlot = 0;
     }
   }
-  else
+
+  if (!RightButtonPressed())
   {
-    if (LeftButtonState == BUTTON_STATE_RELEASED_TIMING)
+    StopPattern(PATTERN_MENU);
+    Slots[MenuSlot].Start();
+    return;
+  }
+
+  SetLayer(PATTERN_MENU, Slots[MenuSlot].LED);
+}
+
+/* A gesture, while every pin in Hold stays down : Count presses of the
+ * Button pins, each within Ms of the one before (GESTURE_TAPS), or the Button
+ * pins held down as well for Ms (GESTURE_HOLD, up to 8 seconds). Matching it
+ * calls Start. It isn't matched while any of the Busy patterns are running.
+ */
+typedef struct {
+  uint8_t Kind;
+  uint8_t Hold;
+  uint8_t Button;
+  uint8_t Count;
+  uint16_t Ms;
+  uint8_t Busy;
+  void (*Start)(void);
+} Gesture_t;
+
+static const Gesture_t Gestures[NUMBER_OF_GESTURES] =
+{
+  // Game : hold left, tap right quickly 4 times
+  {GESTURE_TAPS, BUTTON_PIN_LEFT, BUTTON_PIN_RIGHT, 4, QUICK_PRESS_MS,
+   1 << PATTERN_RIGHT_GAME, StartGame},
+  // Menu : hold right, tap left quickly 4 times
+  {GESTURE_TAPS, BUTTON_PIN_RIGHT, BUTTON_PIN_LEFT, 4, QUICK_PRESS_MS,
+   1 << PATTERN_MENU, StartMenu},
+  // Scan mode : hold both buttons down together
+  {GESTURE_HOLD, BUTTON_PIN_LEFT, BUTTON_PIN_RIGHT, 0, LONG_HOLD_MS,
+   0, SwitchScanMode}
+};
+
+/* Match the hold gestures that have now been held for long enough, and run
+ * TIMER_GESTURE until the soonest of the rest is due.
+ */
+static void MatchHolds(void)
+{
+  uint8_t g;
+  uint16_t held;
+  uint16_t soonest = 0xFFFF;
+
+  HoldsArmed = false;
+  for (g = 0; g < NUMBER_OF_GESTURES; g++)
+  {
+    if ((Gestures[g].Kind != GESTURE_HOLD) || (GestureCount[g] != 1))
     {
-      if (LeftDebounceTimer == 0)
-      {
-        LeftButtonState = BUTTON_STATE_RELEASED;
-      }
+      continue;
     }
-    else if (LeftButtonState != BUTTON_STATE_RELEASED)
+    held = (Time_t)(TimeNow - GestureTime[g]);
+    if (held >= Gestures[g].Ms)
     {
-      LeftButtonState = BUTTON_STATE_RELEASED_TIMING;
-      LeftDebounceTimer = BUTTON_DEBOUNCE_MS;
+      GestureCount[g] = 2;
+      Gestures[g].Start();
     }
-  }
-    
-  // Debounce right button  press
-  if (RightButtonPressedRaw())
-  {
-    if (RightButtonState == BUTTON_STATE_PRESSED_TIMING)
+    else
     {
-      if (RightDebounceTimer == 0)
+      HoldsArmed = true;
+      if ((uint16_t)(Gestures[g].Ms - held) < soonest)
       {
-        RightButtonState = BUTTON_STATE_PRESSED;
+        soonest = (uint16_t)(Gestures[g].Ms - held);
       }
     }
-    else if (RightButtonState != BUTTON_STATE_PRESSED)
-    {
-      RightButtonState = BUTTON_STATE_PRESSED_TIMING;
-      RightDebounceTimer = BUTTON_DEBOUNCE_MS;
-    }
   }
-  else
+
+  if (HoldsArmed)
+  {
+    TimerStart(TIMER_GESTURE, MS_TO_TICKS(soonest));
+  }
+}
+
+// How many ticks before ServiceTimers()'s time an input event tick was, or 0
+// for one ServiceTimers() hasn't caught up with yet
+static uint16_t TicksSince(uint16_t Tick)
+{
+  int16_t age = (int16_t)((uint16_t)(TimeNow * TICKS_PER_MS + TickRemainder) - Tick);
+
+  return (age < 0) ? 0 : (uint16_t)age;
+}
+
+// A button has been debounced down at time PressTime. Start its flash, and
+// keep its press time for the game or the menu.
+static void ButtonPushed(uint8_t Button, Time_t PressTime)
+{
+  if (Button == BUTTON_LEFT)
   {
-    if (RightButtonState == BUTTON_STATE_RELEASED_TIMING)
+    StartPattern(PATTERN_LEFT_FLASH);
+    LastLeftButtonPressTime = PressTime;
+    return;
+  }
+
+  StartPattern(PATTERN_RIGHT_FLASH);
+  LastRightButtonPressTime = PressTime;
+  ReadyTasks |= TASK_GAME;
+}
+
+/* Move every gesture on by one input event : the Pin button went down (or
+ * up) at time Time, and ButtonsDown already has the change. A gesture whose
+ * Hold buttons aren't all down, or that is busy, starts over. Tap gestures
+ * skip releases and other buttons' events, and hold gestures are only armed
+ * here and matched by MatchHolds(), so each event is a fixed amount of work
+ * for each gesture.
+ */
+static void MatchGestures(uint8_t Pin, bool Down, Time_t Time)
+{
+  uint8_t g;
+  const Gesture_t * Gesture;
+
+  for (g = 0; g < NUMBER_OF_GESTURES; g++)
+  {
+    Gesture = &Gestures[g];
+
+    if (((ButtonsDown & Gesture->Hold) != Gesture->Hold) ||
+        (ActivePatterns & Gesture->Busy))
     {
-      if (RightDebounceTimer == 0)
+      GestureCount[g] = 0;
+      continue;
+    }
+
+    if (Gesture->Kind == GESTURE_HOLD)
+    {
+      if ((ButtonsDown & Gesture->Button) != Gesture->Button)
+      {
+        GestureCount[g] = 0;
+      }
+      else if (!GestureCount[g])
       {
-        RightButtonState = BUTTON_STATE_RELEASED;
+        // Held from when the last of its buttons went down
+        GestureCount[g] = 1;
+        GestureTime[g] = Time;
+        HoldsArmed = true;
       }
+      continue;
     }
-    else if (RightButtonState != BUTTON_STATE_RELEASED)
+
+    if ((Pin != Gesture->Button) || !Down)
     {
-      RightButtonState = BUTTON_STATE_RELEASED_TIMING;
-      RightDebounceTimer = BUTTON_DEBOUNCE_MS;
+      continue;
     }
-  }
 
-  if (LeftButtonPressed())
-  {
-    if (LastLeftButtonState == false)
+    // A slow press starts the count over, as the first of a new run
+    if (GestureCount[g] && ((Time_t)(Time - GestureTime[g]) >= Gesture->Ms))
+    {
+      GestureCount[g] = 0;
+    }
+    GestureCount[g]++;
+    GestureTime[g] = Time;
+    if (GestureCount[g] < Gesture->Count)
     {
-      PatternState[PATTERN_LEFT_FLASH] = 1;
+      continue;
     }
-    LastLeftButtonState = true;
+
+    GestureCount[g] = 0;
+    Gesture->Start();
+  }
+
+  if (HoldsArmed)
+  {
+    MatchHolds();
+  }
+}
+
+// A button has been debounced up or down, at tick Tick
+static void ButtonChanged(uint8_t Button, bool Down, uint16_t Tick)
+{
+  Time_t Time;
+
+  if (ButtonPressed(Button) == Down)
+  {
+    return;
+  }
+
+  // The change itself happened when its debounce started
+  Tick = (uint16_t)(Tick - MS_TO_TICKS(BUTTON_DEBOUNCE_MS));
+  Time = (Time_t)(TimeNow - TicksSince(Tick) / TICKS_PER_MS);
+
+  if (Down)
+  {
+    ButtonsDown |= ButtonPin[Button];
+    ButtonPushed(Button, Time);
   }
   else
   {
-    LastLeftButtonState = false;
+    ButtonsDown &= (uint8_t)~ButtonPin[Button];
   }
+  MatchGestures(ButtonPin[Button], Down, Time);
+  // The menu follows left presses and waits for the right button to come up
+  ReadyTasks |= TASK_MENU;
+}
 
-  // Check right button for press
-  if (RightButtonPressed())
+// Return true if either button is down, or being debounced
+bool CheckForButtonPushes(void)
+{
+  uint8_t Event;
+  uint8_t Button;
+  uint8_t Debounced;
+
+  // Take every event in the ring, oldest first
+  while (InputTail != InputHead)
   {
-    if (LastRightButtonState == false)
-    {
-      PatternState[PATTERN_RIGHT_FLASH] = 1;
-      
-      // Check for entry into game mode
-      if (LeftButtonPressed())
-      {
-        if (WakeTimer < (LastRightButtonPressTime + QUICK_PRESS_MS))
-        {
-          LeftButtonQuickPressCount++;
+    Event = InputEvent[InputTail];
+    ButtonChanged(INPUT_BUTTON(Event), INPUT_DOWN(Event), InputTick[InputTail]);
+    InputTail = (uint8_t)((InputTail + 1) & (INPUT_RING_SIZE - 1));
+  }
 
-          if (LeftButtonQuickPressCount == 4)
-          {
-              // Enter into game mode
-              PatternState[PATTERN_RIGHT_FLASH] = 0;
-              PatternState[PATTERN_LEFT_FLASH] = 0;
-              PatternState[PATTERN_RIGHT_GAME] = 1;
-
-//          SetLEDOn(LED_R_RED);
-//          SetLEDOn(LED_R_GREEN);
-//          SetLEDOn(LED_R_BLUE);
-//          SetLEDOn(LED_R_YELLOW);
-//          SetLEDOn(LED_L_YELLOW);
-//          SetLEDOn(LED_L_BLUE);
-//          SetLEDOn(LED_L_GREEN);
-//          SetLEDOn(LED_L_RED);
-
-//          __delay_ms(1000);        
-          }
-        }
-        else
-        {
-            LeftButtonQuickPressCount = 0;
-        }
-      }
-      LastRightButtonPressTime = WakeTimer;
+  // If events were dropped, the debouncer's state is the only record of
+  // where they ended up
+  if (InputOverflow)
+  {
+    InputOverflow = false;
+    Debounced = ButtonsDebounced;
+    for (Button = 0; Button < NUMBER_OF_BUTTONS; Button++)
+    {
+      ButtonChanged(Button, (Debounced & ButtonPin[Button]) != 0,
+                    (uint16_t)(TimeNow * TICKS_PER_MS + TickRemainder));
     }
-    LastRightButtonState = true;
   }
-  else
+
+  // A hold gesture's timer has run out
+  if (HoldsArmed && !TimerRunning(TIMER_GESTURE))
   {
-    LastRightButtonState = false;
+    MatchHolds();
   }
-  
-  return ((bool)(LeftButtonPressedRaw() || RightButtonPressedRaw()));
+
+  return ((bool)((ButtonsDown | ButtonsChanging) != 0));
 }
 
 /*
@@ -881,7 +1712,13 @@ void main(void)
   // initialize the device
   SYSTEM_Initialize();
 
+#if !INTERRUPT_STATIC_HANDLERS
   TMR0_SetInterruptHandler(TMR0_Callback);
+#endif
+  TimersInitialize();
+
+  // Let the scan rate governor pick the first TMR0 period
+  UpdateScanList();
 
   // When using interrupts, you need to set the Global and Peripheral Interrupt Enable bits
   // Use the following macros to:
@@ -898,36 +1735,71 @@ void main(void)
   // Disable the Peripheral Interrupts
   //INTERRUPT_PeripheralInterruptDisable();
     
-  uint8_t i;
   bool APatternIsRunning = false;
-  
+  uint8_t Ready;
+  uint8_t WasRunning;
+
+  // Look at the buttons once to start with, since they woke us up
+  ReadyTasks |= TASK_BUTTONS;
+
   while (1)
   {
-    RunRightFlash();
-    RunLeftFlash();
-    RunGame();
-    
-    APatternIsRunning = false;
-    for (i=0; i < 8; i++)
+    /* Only run the tasks that have something to do. With nothing to do,
+     * wait for an interrupt to give us something. The core can't sleep
+     * here, as that would stop TMR0 and the LED scan with it.
+     */
+    Ready = TakeReadyTasks();
+    if (!Ready)
     {
-      if (PatternState[i] != 0)
+      while (!ReadyTasks)
       {
-        APatternIsRunning = true;
       }
+      continue;
+    }
+
+    if (Ready & TASK_TIMERS)
+    {
+      ServiceTimers();
+    }
+    if (Ready & TASK_PATTERNS)
+    {
+      RunPatterns();
     }
-    if ((!APatternIsRunning && RightDebounceTimer == 0 && LeftDebounceTimer == 0) || (WakeTimer > MAX_AWAKE_TIME_MS))
+    if (Ready & TASK_GAME)
+    {
+      RunGame();
+    }
+    if (Ready & TASK_MENU)
+    {
+      RunMenu();
+    }
+    CommitLEDs();
+    
+    APatternIsRunning = (ActivePatterns != 0);
+    SetPatternsRunning(APatternIsRunning);
+    if ((!APatternIsRunning && !ButtonsChanging) || (WakeSeconds >= MAX_AWAKE_TIME_S))
     {
       SetAllLEDsOff();
+      CommitLEDs();
       // Allow LEDsOff command to percolate to LEDs
       __delay_ms(5);
 
-      ShutdownDelayTimer = SHUTDOWN_DELAY_MS;
-
-      while (ShutdownDelayTimer && !CheckForButtonPushes())
+      // Catch up first, so the delay doesn't count the time already gone
+      ServiceTimers();
+      TimerStart(TIMER_SHUTDOWN, MS_TO_TICKS(SHUTDOWN_DELAY_MS));
+
+      // A press that finishes debouncing in here starts a pattern even if
+      // the button is already back up, so look for a pattern that wasn't
+      // running before. Patterns that were (the game never stops) don't
+      // count, and once we've been awake too long no new one does either.
+      WasRunning = (WakeSeconds >= MAX_AWAKE_TIME_S) ? 0xFF : ActivePatterns;
+      while (TimerRunning(TIMER_SHUTDOWN) && !CheckForButtonPushes() &&
+             !(ActivePatterns & (uint8_t)~WasRunning))
       {
+        ServiceTimers();
       }
 
-      if (ShutdownDelayTimer == 0)
+      if (!TimerRunning(TIMER_SHUTDOWN))
       {
           // Hit the VREGPM bit to put us in low power sleep mode
         VREGCONbits.VREGPM = 1;
@@ -935,11 +1807,15 @@ void main(void)
         SLEEP();
 
         // Start off with time = 0;
-        WakeTimer = 0;
+        WakeSeconds = 0;
+        WakeMs = 0;
       }
     }
 
-    CheckForButtonPushes();
+    if (Ready & TASK_BUTTONS)
+    {
+      CheckForButtonPushes();
+    }
   }
 }
 /**
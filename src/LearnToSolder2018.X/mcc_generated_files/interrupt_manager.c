@@ -51,6 +51,29 @@
 void interrupt INTERRUPT_InterruptManager (void)
 {
     // interrupt handler
+#if INTERRUPT_STATIC_HANDLERS
+    if(INTCONbits.TMR0IE == 1 && INTCONbits.TMR0IF == 1)
+    {
+        // Same as TMR0_ISR()
+        INTCONbits.TMR0IF = 0;
+        TMR0 += (uint8_t)(timer0ReloadVal + TMR0_RELOAD_ADJUST);
+        TMR0_STATIC_HANDLER();
+    }
+    else if(INTCONbits.IOCIE == 1 && INTCONbits.IOCIF == 1)
+    {
+        // Same as PIN_MANAGER_IOC()
+        if(IOCAFbits.IOCAF2 == 1)
+        {
+            IOCAF2_STATIC_HANDLER();
+            IOCAFbits.IOCAF2 = 0;
+        }
+        if(IOCAFbits.IOCAF3 == 1)
+        {
+            IOCAF3_STATIC_HANDLER();
+            IOCAFbits.IOCAF3 = 0;
+        }
+    }
+#else
     if(INTCONbits.TMR0IE == 1 && INTCONbits.TMR0IF == 1)
     {
         TMR0_ISR();
@@ -59,6 +82,7 @@ void interrupt INTERRUPT_InterruptManager (void)
     {
         PIN_MANAGER_IOC();
     }
+#endif
     else
     {
         //Unhandled Interrupt
@@ -48,6 +48,31 @@
 #ifndef INTERRUPT_MANAGER_H
 #define INTERRUPT_MANAGER_H
 
+/**
+  @Summary
+    Compile time interrupt handlers
+
+  @Description
+    When INTERRUPT_STATIC_HANDLERS is 1, INTERRUPT_InterruptManager() clears
+    the flags and calls the handlers named below itself, rather than going
+    through TMR0_ISR(), TMR0_CallBack(), PIN_MANAGER_IOC(), IOCAFx_ISR() and
+    the ..._InterruptHandler function pointers. The ..._SetInterruptHandler()
+    functions are then not built. Define it as 0 (e.g. in the project's
+    preprocessor macros) to get the runtime handlers back.
+*/
+#ifndef INTERRUPT_STATIC_HANDLERS
+#define INTERRUPT_STATIC_HANDLERS   1
+#endif
+
+#if INTERRUPT_STATIC_HANDLERS
+#define TMR0_STATIC_HANDLER()       TMR0_Callback()
+#define IOCAF2_STATIC_HANDLER()     IOCAF2_DefaultInterruptHandler()
+#define IOCAF3_STATIC_HANDLER()     IOCAF3_DefaultInterruptHandler()
+
+// In main.c
+void TMR0_Callback(void);
+#endif
+
 
 /**
  * @Param
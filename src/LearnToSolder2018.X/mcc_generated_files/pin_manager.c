@@ -46,10 +46,13 @@
 #include <xc.h>
 #include "pin_manager.h"
 #include "stdbool.h"
+#include "interrupt_manager.h"
 
 
+#if !INTERRUPT_STATIC_HANDLERS
 void (*IOCAF2_InterruptHandler)(void);
 void (*IOCAF3_InterruptHandler)(void);
+#endif
 
 
 void PIN_MANAGER_Initialize(void)
@@ -98,15 +101,18 @@ void PIN_MANAGER_Initialize(void)
     IOCAPbits.IOCAP2 = 1;
     IOCAPbits.IOCAP3 = 1;
 
+#if !INTERRUPT_STATIC_HANDLERS
     // register default IOC callback functions at runtime; use these methods to register a custom function
     IOCAF2_SetInterruptHandler(IOCAF2_DefaultInterruptHandler);
     IOCAF3_SetInterruptHandler(IOCAF3_DefaultInterruptHandler);
+#endif
    
     // Enable IOCI interrupt 
     INTCONbits.IOCIE = 1; 
     
 }       
 
+#if !INTERRUPT_STATIC_HANDLERS
 void PIN_MANAGER_IOC(void)
 {   
     // interrupt on change for pin IOCAF2
@@ -145,6 +151,7 @@ void IOCAF2_ISR(void) {
 void IOCAF2_SetInterruptHandler(void (* InterruptHandler)(void)){
     IOCAF2_InterruptHandler = InterruptHandler;
 }
+#endif
 
 /**
   Default interrupt handler for IOCAF2
@@ -154,6 +161,7 @@ void IOCAF2_DefaultInterruptHandler(void){
     // or set custom function using IOCAF2_SetInterruptHandler()
 }
 
+#if !INTERRUPT_STATIC_HANDLERS
 /**
    IOCAF3 Interrupt Service Routine
 */
@@ -175,6 +183,7 @@ void IOCAF3_ISR(void) {
 void IOCAF3_SetInterruptHandler(void (* InterruptHandler)(void)){
     IOCAF3_InterruptHandler = InterruptHandler;
 }
+#endif
 
 /**
   Default interrupt handler for IOCAF3
@@ -49,27 +49,30 @@
 
 #include <xc.h>
 #include "tmr0.h"
+#include "interrupt_manager.h"
 
 /**
   Section: Global Variables Definitions
 */
 
 volatile uint8_t timer0ReloadVal;
+#if !INTERRUPT_STATIC_HANDLERS
 void (*TMR0_InterruptHandler)(void);
+#endif
 /**
   Section: TMR0 APIs
 */
 
-#define TMR0_RELOAD 0x87        // Each of LEDs serviced for 125uS every 1ms
+#define TMR0_RELOAD 0xC2        // 124uS until main.c picks its own periods
 
 void TMR0_Initialize(void)
 {
     // Set TMR0 to the options selected in the User Interface
 	
-    // PSA assigned; PS 1:4; TMRSE Increment_hi_lo; mask the nWPUEN and INTEDG bits
-    OPTION_REG = (uint8_t)((OPTION_REG & 0xC0) | 0xD1 & 0x3F); 
+    // PSA assigned; PS 1:8; TMRSE Increment_hi_lo; mask the nWPUEN and INTEDG bits
+    OPTION_REG = (uint8_t)((OPTION_REG & 0xC0) | 0xD2 & 0x3F); 
 	
-    // TMR0 6; 
+    // TMR0 194; 
     TMR0 = TMR0_RELOAD;
 	
     // Load the TMR value to reload variable
@@ -105,13 +108,14 @@ void TMR0_Reload(void)
 }
 #endif
 
+#if !INTERRUPT_STATIC_HANDLERS
 void TMR0_ISR(void)
 {
 
     // Clear the TMR0 interrupt flag
     INTCONbits.TMR0IF = 0;
 
-    TMR0 = timer0ReloadVal;
+    TMR0 += (uint8_t)(timer0ReloadVal + TMR0_RELOAD_ADJUST);
 
     // ticker function call;
     // ticker is 1 -> Callback function gets called every time this ISR executes
@@ -133,6 +137,7 @@ void TMR0_CallBack(void)
 void TMR0_SetInterruptHandler(void (* InterruptHandler)(void)){
     TMR0_InterruptHandler = InterruptHandler;
 }
+#endif
 
 #if 0
 void TMR0_DefaultInterruptHandler(void){
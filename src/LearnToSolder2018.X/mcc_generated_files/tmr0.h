@@ -65,6 +65,11 @@
 
 #define TMR0_INTERRUPT_TICKER_FACTOR    1
 
+// Counts added on top of timer0ReloadVal when the interrupt reloads TMR0. The
+// write clears the prescaler and stops TMR0 for 2 cycles, which loses about
+// 0.7 of a count each period, so the reload makes up for it with 1.
+#define TMR0_RELOAD_ADJUST              1
+
 /**
   Section: TMR0 APIs
 */
@@ -277,6 +282,26 @@ void TMR0_CallBack(void);
 */
 extern void (*TMR0_InterruptHandler)(void);
 
+/**
+  @Summary
+    Timer Reload Value
+
+  @Description
+    This is the value added to TMR0 at the start of every TMR0 interrupt.
+    At 16MHz with the 1:8 prescaler TMR0 counts every 2uS, so the period
+    until the next interrupt is (256 - timer0ReloadVal) * 2uS. It is added
+    rather than written, so the counts TMR0 has already made since it
+    overflowed (the interrupt latency) still count towards the period.
+
+  @Preconditions
+    Initialize  the TMR0 module before changing this.
+
+  @Comment
+    The interrupt handler can change it to set the length of the period
+    after the one that is just starting.
+*/
+extern volatile uint8_t timer0ReloadVal;
+
 /**
   @Summary
     Default Timer Interrupt Handler
@@ -0,0 +1,804 @@
+/*
+ * Learn To Solder 2018 host simulator
+ *
+ * Runs the real main.c and MCC drivers on a PC against the mock xc.h in
+ * this directory, so changes to the ISR or pattern code can be measured
+ * without a PICkit on the bench.
+ *
+ * Copyright 2018
+ * All of this code is in the public domain
+ *
+ * How it works:
+ *   - The firmware is built with -fsanitize-coverage=trace-pc, so every
+ *     basic block it executes calls __sanitizer_cov_trace_pc(). Each block
+ *     is charged SIM_CYCLES_PER_BLOCK instruction cycles (Fosc/4 = 4 MHz).
+ *     That is an estimate, calibrated against the XC8 listing of
+ *     TMR0_Callback (about 4 PIC instructions per host basic block).
+ *   - Simulated time only moves forward through those charges, __delay_ms()
+ *     and SLEEP(). TMR0 is clocked from it exactly as OPTION_REG configures
+ *     it (Fosc/4, prescaler, 2 cycle inhibit after a write), so the 0x87
+ *     reload gives the same ~125 us tick as the board.
+ *   - Interrupts are taken between basic blocks: when GIE is set and TMR0IF
+ *     or IOCIF is pending, INTERRUPT_InterruptManager() is called right
+ *     there, on top of whatever the main loop was doing.
+ *   - The firmware is also built with -finstrument-functions, and cycles
+ *     are accumulated per function, separately for interrupt and main loop
+ *     context (ISR time is not billed to the main loop function it
+ *     interrupted).
+ *   - After every block the Charlieplex pins are decoded into the eight
+ *     LEDs and their on-time is accumulated.
+ *   - Every firmware access to PORTA, LATA or TRISA also samples the pins
+ *     (see SimPinRegister() in xc.h), so states between two writes in the
+ *     same block are seen too. A state that lights any LED for less than
+ *     GHOST_CYCLES is counted as a ghost : a glimmer on an LED that should
+ *     be dark, or a stray flash.
+ *
+ * Usage:
+ *   ltsim [-t ms] [-p ms] <scenario | event...>
+ *     scenario   one of the names in the Scenarios[] table below
+ *     event      <ms>:<L|R><+|->        press (+) or release (-) a button
+ *                <ms>:<L|R>x<n>/<ms>    tap a button n times at that period
+ *     -t ms      stop after this much simulated time (default: 2 s after
+ *                the last event, or when the firmware sleeps for good)
+ *     -p ms      print the LED pin timeline, TRACE_STATES states from here
+ */
+
+#define _GNU_SOURCE
+#define SIM_INTERNAL
+#include <elf.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xc.h"
+
+#ifndef SIM_CYCLES_PER_BLOCK
+#define SIM_CYCLES_PER_BLOCK    4
+#endif
+
+// Instruction cycles per millisecond at 16 MHz Fosc
+#define CYCLES_PER_MS           4000UL
+
+// Interrupt latency into the vector, and the RETFIE out of it
+#define ISR_ENTRY_CYCLES        3
+#define ISR_EXIT_CYCLES         2
+
+// Instruction cycles available between two 125 us scan ticks
+#define TICK_BUDGET_CYCLES      500
+
+// Button pins (pressed = low)
+#define PIN_LEFT                2
+#define PIN_RIGHT               3
+
+// Pins used to Charlieplex the LEDs
+#define LED_PINS                0x33
+
+// A pin state lighting an LED for less than this is a ghost. The shortest
+// real BAM plane is 40 us, less the ISR's own time.
+#define GHOST_CYCLES            16
+
+// Pin states printed by -p
+#define TRACE_STATES            64
+
+#define MAX_EVENTS              256
+#define MAX_FRAMES              64
+#define MAX_FUNCS               64
+
+typedef struct {
+  uint64_t Cycle;
+  uint8_t Pin;
+  bool Pressed;
+} Event_t;
+
+typedef struct {
+  const char * Name;
+  const char * Events;
+} Scenario_t;
+
+typedef struct {
+  void * Fn;
+  uint8_t Context;
+  uint64_t Start;
+} Frame_t;
+
+typedef struct {
+  void * Fn;
+  uint8_t Context;
+  uint32_t Calls;
+  uint64_t Total;
+  uint64_t Max;
+} FuncStats_t;
+
+// Each LED, in LEDOns bit order, with the pin driven high and the pin sunk low
+static const struct {
+  const char * Name;
+  uint8_t Anode;
+  uint8_t Cathode;
+} LEDs[8] = {
+  {"R red",    0, 1},
+  {"R green",  1, 0},
+  {"R blue",   4, 5},
+  {"R yellow", 5, 4},
+  {"L yellow", 5, 0},
+  {"L blue",   0, 5},
+  {"L green",  4, 1},
+  {"L red",    1, 4},
+};
+
+static const Scenario_t Scenarios[] = {
+  {"idle",       ""},
+  {"tap-right",  "10:R+ 150:R-"},
+  {"hold-right", "10:R+ 4000:R-"},
+  {"hold-both",  "10:L+ 10:R+ 3000:L- 3000:R-"},
+  {"game",       "10:L+ 100:Rx5/200 1100:L- 1300:Rx30/100"},
+};
+
+// Register storage behind the mock xc.h
+volatile PORTAbits_t PORTAbits;
+volatile LATAbits_t LATAbits;
+volatile TRISAbits_t TRISAbits = {.reg = 0x3F};
+volatile INTCONbits_t INTCONbits;
+volatile OPTION_REGbits_t OPTION_REGbits = {.reg = 0xFF};
+volatile VREGCONbits_t VREGCONbits;
+volatile IOCAFbits_t IOCAFbits;
+volatile IOCANbits_t IOCANbits;
+volatile IOCAPbits_t IOCAPbits;
+volatile WPUAbits_t WPUAbits = {.reg = 0x3F};
+volatile ANSELAbits_t ANSELAbits = {.reg = 0x17};
+volatile ODCONAbits_t ODCONAbits;
+volatile uint8_t TMR0;
+volatile uint8_t OSCCON;
+volatile uint8_t OSCTUNE;
+volatile uint8_t BORCON;
+volatile uint8_t WDTCON;
+volatile uint8_t APFCON;
+
+extern void firmware_main(void);
+extern void INTERRUPT_InterruptManager(void);
+
+static jmp_buf SimExit;
+static const char * ExitReason;
+static uint64_t StopCycle;
+
+// Simulated time, and the part of it spent awake in each context
+static uint64_t Cycle;
+static uint64_t ContextCycles[2];
+static bool InISR;
+
+static Event_t Events[MAX_EVENTS];
+static uint16_t EventCount;
+static uint16_t NextEvent;
+// External level of the pins, only the buttons are ever driven
+static uint8_t PinsIn = (1 << PIN_LEFT) | (1 << PIN_RIGHT);
+
+// TMR0 model state
+static uint8_t TMR0Last;
+static uint16_t Prescale;
+static uint8_t TMR0Inhibit;
+
+// Last value PORTA was given, so a firmware write to it can be seen
+static uint8_t PORTAPublished;
+
+static Frame_t Frames[MAX_FRAMES];
+static uint8_t FrameDepth;
+static FuncStats_t Funcs[MAX_FUNCS];
+static uint8_t FuncCount;
+
+static uint64_t TickCount;
+static uint64_t LastTickCycle;
+static uint64_t TickPeriodTotal;
+static uint64_t TickPeriodMin = UINT64_MAX;
+// TMR0 interrupts still running when TMR0 overflowed again
+static unsigned IsrOverruns = 0;
+static uint64_t AwakeCycles;
+static uint64_t LEDOnCycles[8];
+static uint32_t SleepCount;
+
+// LED pin state as last sampled, and when it started
+static uint8_t PinTRIS = 0x3F;
+static uint8_t PinLAT;
+static uint8_t PinLit;
+static uint64_t PinSince;
+static uint32_t GhostCount[8];
+static uint64_t TraceCycle = UINT64_MAX;
+static uint16_t TraceLines;
+
+static void SimFinish(const char * Reason)
+{
+  ExitReason = Reason;
+  longjmp(SimExit, 1);
+}
+
+static void SimApplyEvent(const Event_t * Ev)
+{
+  uint8_t before = PinsIn;
+
+  if (Ev->Pressed)
+  {
+    PinsIn = (uint8_t)(PinsIn & ~(1 << Ev->Pin));
+  }
+  else
+  {
+    PinsIn = (uint8_t)(PinsIn | (1 << Ev->Pin));
+  }
+
+  // Latch interrupt-on-change flags for the enabled edge
+  if ((before & ~PinsIn) & IOCAN)
+  {
+    IOCAF = (uint8_t)(IOCAF | (before & ~PinsIn));
+  }
+  if ((PinsIn & ~before) & IOCAP)
+  {
+    IOCAF = (uint8_t)(IOCAF | (PinsIn & ~before));
+  }
+}
+
+/* Resolve firmware writes to PORTA into LATA, then rebuild PORTA from the
+ * pins. Output pins read back their latch, the buttons read the outside
+ * world, and a floating LED pin is taken to read its latch as well, which
+ * keeps every write to a LED pin visible here.
+ */
+static void SimSyncPins(void)
+{
+  uint8_t outputs;
+
+  if (PORTA != PORTAPublished)
+  {
+    LATA = PORTA;
+  }
+  outputs = (uint8_t)~TRISA;
+  PORTA = (uint8_t)((LATA & (outputs | LED_PINS)) | (PinsIn & ~(outputs | LED_PINS) & 0x3F));
+  PORTAPublished = PORTA;
+
+  INTCONbits.IOCIF = ((IOCAF & 0x3F) != 0);
+}
+
+static bool SimPinHigh(uint8_t Pin)
+{
+  return (!(TRISA & (1 << Pin)) && (LATA & (1 << Pin)));
+}
+
+static bool SimPinLow(uint8_t Pin)
+{
+  return (!(TRISA & (1 << Pin)) && !(LATA & (1 << Pin)));
+}
+
+// Print a pin as H, L or Z (floating)
+static char SimPinLevel(uint8_t Tris, uint8_t Lat, uint8_t Pin)
+{
+  if (Tris & (1 << Pin))
+  {
+    return 'Z';
+  }
+  return (Lat & (1 << Pin)) ? 'H' : 'L';
+}
+
+/* Bring the pins up to date, and if the LED pins have changed since last
+ * time, close off the state they were in : count it as a ghost if it lit an
+ * LED too briefly, and print it if -p asked for the timeline.
+ */
+static void SimPinSample(void)
+{
+  uint8_t i;
+  uint8_t lit = 0;
+  bool ghost;
+
+  SimSyncPins();
+  if ((TRISA & LED_PINS) == PinTRIS && (LATA & LED_PINS) == PinLAT)
+  {
+    return;
+  }
+
+  ghost = (PinLit && Cycle - PinSince < GHOST_CYCLES);
+  for (i = 0; i < 8; i++)
+  {
+    if (ghost && (PinLit & (1 << i)))
+    {
+      GhostCount[i]++;
+    }
+    if (SimPinHigh(LEDs[i].Anode) && SimPinLow(LEDs[i].Cathode))
+    {
+      lit = (uint8_t)(lit | (1 << i));
+    }
+  }
+
+  if (PinSince >= TraceCycle && TraceLines < TRACE_STATES)
+  {
+    printf("   %10.2f us %6llu cyc  GP0 %c GP1 %c GP4 %c GP5 %c  lit:",
+      PinSince / 4.0, (unsigned long long)(Cycle - PinSince),
+      SimPinLevel(PinTRIS, PinLAT, 0), SimPinLevel(PinTRIS, PinLAT, 1),
+      SimPinLevel(PinTRIS, PinLAT, 4), SimPinLevel(PinTRIS, PinLAT, 5));
+    for (i = 0; i < 8; i++)
+    {
+      if (PinLit & (1 << i))
+      {
+        printf(" %s", LEDs[i].Name);
+      }
+    }
+    printf("%s\n", ghost ? "  << GHOST" : "");
+    TraceLines++;
+  }
+
+  PinTRIS = (uint8_t)(TRISA & LED_PINS);
+  PinLAT = (uint8_t)(LATA & LED_PINS);
+  PinLit = lit;
+  PinSince = Cycle;
+}
+
+volatile uint8_t * SimPinRegister(volatile uint8_t * Reg)
+{
+  SimPinSample();
+  return Reg;
+}
+
+static void SimClockCycle(void)
+{
+  Cycle++;
+
+  // TMR0 written by the firmware since the last cycle clears the prescaler
+  // and holds off counting for two cycles
+  if (TMR0 != TMR0Last)
+  {
+    Prescale = 0;
+    TMR0Inhibit = 2;
+  }
+
+  if (TMR0Inhibit)
+  {
+    TMR0Inhibit--;
+  }
+  else if (!OPTION_REGbits.TMR0CS)
+  {
+    Prescale++;
+    if (OPTION_REGbits.PSA || Prescale >= (2U << OPTION_REGbits.PS))
+    {
+      Prescale = 0;
+      TMR0++;
+      if (TMR0 == 0)
+      {
+        INTCONbits.TMR0IF = 1;
+      }
+    }
+  }
+  TMR0Last = TMR0;
+
+  while (NextEvent < EventCount && Events[NextEvent].Cycle <= Cycle)
+  {
+    SimApplyEvent(&Events[NextEvent++]);
+  }
+}
+
+// Burn some awake instruction cycles in the current context
+static void SimStep(uint32_t Cycles)
+{
+  uint8_t i;
+
+  SimPinSample();
+
+  for (i = 0; i < 8; i++)
+  {
+    if (SimPinHigh(LEDs[i].Anode) && SimPinLow(LEDs[i].Cathode))
+    {
+      LEDOnCycles[i] += Cycles;
+    }
+  }
+  AwakeCycles += Cycles;
+  ContextCycles[InISR] += Cycles;
+
+  while (Cycles--)
+  {
+    SimClockCycle();
+  }
+
+  if (Cycle >= StopCycle)
+  {
+    SimFinish("time limit");
+  }
+}
+
+static void SimCheckInterrupts(void)
+{
+  bool tmr0;
+
+  SimSyncPins();
+  if (!INTCONbits.GIE)
+  {
+    return;
+  }
+
+  tmr0 = (INTCONbits.TMR0IE && INTCONbits.TMR0IF);
+  if (!tmr0 && !(INTCONbits.IOCIE && INTCONbits.IOCIF))
+  {
+    return;
+  }
+
+  if (tmr0)
+  {
+    if (TickCount)
+    {
+      TickPeriodTotal += Cycle - LastTickCycle;
+      if (Cycle - LastTickCycle < TickPeriodMin)
+      {
+        TickPeriodMin = Cycle - LastTickCycle;
+      }
+    }
+    LastTickCycle = Cycle;
+    TickCount++;
+  }
+
+  InISR = true;
+  INTCONbits.GIE = 0;
+  SimStep(ISR_ENTRY_CYCLES);
+  INTERRUPT_InterruptManager();
+  SimStep(ISR_EXIT_CYCLES);
+  if (tmr0 && INTCONbits.TMR0IF)
+  {
+    IsrOverruns++;
+  }
+  INTCONbits.GIE = 1;
+  InISR = false;
+}
+
+void __sanitizer_cov_trace_pc(void)
+{
+  SimStep(SIM_CYCLES_PER_BLOCK);
+  if (!InISR)
+  {
+    SimCheckInterrupts();
+  }
+}
+
+void __cyg_profile_func_enter(void * Fn, void * CallSite)
+{
+  (void)CallSite;
+
+  if (FrameDepth < MAX_FRAMES)
+  {
+    Frames[FrameDepth].Fn = Fn;
+    Frames[FrameDepth].Context = InISR;
+    // The trace-pc call for the entry block comes just before this hook,
+    // so that block has already been charged
+    Frames[FrameDepth].Start = ContextCycles[InISR] - SIM_CYCLES_PER_BLOCK;
+  }
+  FrameDepth++;
+}
+
+void __cyg_profile_func_exit(void * Fn, void * CallSite)
+{
+  uint8_t i;
+  uint64_t spent;
+  Frame_t * frame;
+
+  (void)Fn;
+  (void)CallSite;
+
+  FrameDepth--;
+  if (FrameDepth >= MAX_FRAMES)
+  {
+    return;
+  }
+  frame = &Frames[FrameDepth];
+  spent = ContextCycles[frame->Context] - frame->Start;
+
+  for (i = 0; i < FuncCount; i++)
+  {
+    if (Funcs[i].Fn == frame->Fn && Funcs[i].Context == frame->Context)
+    {
+      break;
+    }
+  }
+  if (i == FuncCount)
+  {
+    if (FuncCount == MAX_FUNCS)
+    {
+      return;
+    }
+    Funcs[FuncCount].Fn = frame->Fn;
+    Funcs[FuncCount].Context = frame->Context;
+    FuncCount++;
+  }
+  Funcs[i].Calls++;
+  Funcs[i].Total += spent;
+  if (spent > Funcs[i].Max)
+  {
+    Funcs[i].Max = spent;
+  }
+}
+
+void SimDelayCycles(uint32_t Cycles)
+{
+  while (Cycles)
+  {
+    uint32_t chunk = (Cycles > SIM_CYCLES_PER_BLOCK) ? SIM_CYCLES_PER_BLOCK : Cycles;
+
+    SimStep(chunk);
+    Cycles -= chunk;
+    if (!InISR)
+    {
+      SimCheckInterrupts();
+    }
+  }
+}
+
+/* The oscillator stops in sleep, so TMR0 freezes and time jumps straight to
+ * the next button event. Only an enabled interrupt-on-change edge wakes the
+ * part back up.
+ */
+void SimSleep(void)
+{
+  SleepCount++;
+
+  while (1)
+  {
+    if (NextEvent == EventCount || Events[NextEvent].Cycle >= StopCycle)
+    {
+      SimFinish("asleep");
+    }
+    Cycle = Events[NextEvent].Cycle;
+    SimApplyEvent(&Events[NextEvent++]);
+
+    if (INTCONbits.IOCIE && (IOCAF & 0x3F))
+    {
+      SimSyncPins();
+      return;
+    }
+  }
+}
+
+static void SimAddEvent(uint64_t Ms, char Button, bool Pressed)
+{
+  if (EventCount == MAX_EVENTS)
+  {
+    fprintf(stderr, "ltsim: too many events\n");
+    exit(2);
+  }
+  Events[EventCount].Cycle = Ms * CYCLES_PER_MS;
+  Events[EventCount].Pin = (Button == 'L') ? PIN_LEFT : PIN_RIGHT;
+  Events[EventCount].Pressed = Pressed;
+  EventCount++;
+}
+
+static void SimParseEvent(const char * Text)
+{
+  unsigned long ms;
+  unsigned long count;
+  unsigned long period;
+  unsigned long n;
+  char button;
+  char edge;
+
+  if (sscanf(Text, "%lu:%c%c", &ms, &button, &edge) != 3 || (button != 'L' && button != 'R'))
+  {
+    fprintf(stderr, "ltsim: bad event '%s'\n", Text);
+    exit(2);
+  }
+
+  if (edge == 'x')
+  {
+    if (sscanf(Text, "%lu:%*c%*c%lu/%lu", &ms, &count, &period) != 3 || period < 2)
+    {
+      fprintf(stderr, "ltsim: bad tap event '%s'\n", Text);
+      exit(2);
+    }
+    for (n = 0; n < count; n++)
+    {
+      SimAddEvent(ms + n * period, button, true);
+      SimAddEvent(ms + n * period + period / 2, button, false);
+    }
+  }
+  else if (edge == '+' || edge == '-')
+  {
+    SimAddEvent(ms, button, (edge == '+'));
+  }
+  else
+  {
+    fprintf(stderr, "ltsim: bad event '%s'\n", Text);
+    exit(2);
+  }
+}
+
+static void SimParseEvents(const char * Text)
+{
+  char buffer[512];
+  char * token;
+
+  snprintf(buffer, sizeof(buffer), "%s", Text);
+  for (token = strtok(buffer, " "); token; token = strtok(NULL, " "))
+  {
+    SimParseEvent(token);
+  }
+}
+
+static int SimCompareEvents(const void * A, const void * B)
+{
+  const Event_t * a = A;
+  const Event_t * b = B;
+
+  return (a->Cycle > b->Cycle) - (a->Cycle < b->Cycle);
+}
+
+/* Look a firmware function up by address in our own ELF symbol table.
+ * Static functions never make it into the dynamic symbol table, so dladdr()
+ * is no use here.
+ */
+static const char * SimFunctionName(void * Fn)
+{
+  static char * image;
+  static Elf64_Sym * symbols;
+  static size_t symbolCount;
+  static const char * strings;
+  static uintptr_t bias;
+  size_t i;
+
+  if (!image)
+  {
+    FILE * f = fopen("/proc/self/exe", "rb");
+    Elf64_Ehdr * header;
+    Elf64_Shdr * sections;
+    long size;
+
+    if (!f)
+    {
+      return "?";
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    image = malloc((size_t)size);
+    if (fread(image, 1, (size_t)size, f) != (size_t)size)
+    {
+      fclose(f);
+      return "?";
+    }
+    fclose(f);
+
+    header = (Elf64_Ehdr *)image;
+    sections = (Elf64_Shdr *)(image + header->e_shoff);
+    for (i = 0; i < header->e_shnum; i++)
+    {
+      if (sections[i].sh_type == SHT_SYMTAB)
+      {
+        symbols = (Elf64_Sym *)(image + sections[i].sh_offset);
+        symbolCount = sections[i].sh_size / sizeof(Elf64_Sym);
+        strings = image + sections[sections[i].sh_link].sh_offset;
+      }
+    }
+
+    // Work out where a position independent executable got loaded
+    for (i = 0; i < symbolCount; i++)
+    {
+      if (strcmp(strings + symbols[i].st_name, "firmware_main") == 0)
+      {
+        bias = (uintptr_t)firmware_main - symbols[i].st_value;
+      }
+    }
+  }
+
+  for (i = 0; i < symbolCount; i++)
+  {
+    if (ELF64_ST_TYPE(symbols[i].st_info) == STT_FUNC && symbols[i].st_value + bias == (uintptr_t)Fn)
+    {
+      return strings + symbols[i].st_name;
+    }
+  }
+  return "?";
+}
+
+static void SimReport(const char * Name)
+{
+  uint8_t i;
+  uint64_t isrTotal = ContextCycles[1];
+  uint64_t isrMax = 0;
+
+  for (i = 0; i < FuncCount; i++)
+  {
+    if (Funcs[i].Context && strcmp(SimFunctionName(Funcs[i].Fn), "INTERRUPT_InterruptManager") == 0)
+    {
+      isrMax = Funcs[i].Max + ISR_ENTRY_CYCLES + ISR_EXIT_CYCLES;
+    }
+  }
+
+  printf("== %s: stopped (%s) at %.1f ms, awake %.1f ms, slept %u time(s)\n",
+    Name, ExitReason, Cycle / (double)CYCLES_PER_MS, AwakeCycles / (double)CYCLES_PER_MS, SleepCount);
+  printf("   %llu interrupts, TMR0 period avg %.1f us (%.2f kHz) min %.1f us, ISR %.1f%% of awake cycles\n",
+    (unsigned long long)TickCount,
+    (TickCount > 1) ? TickPeriodTotal / (double)(TickCount - 1) / 4.0 : 0.0,
+    TickPeriodTotal ? 4000.0 * (TickCount - 1) / TickPeriodTotal : 0.0,
+    (TickCount > 1) ? TickPeriodMin / 4.0 : 0.0,
+    AwakeCycles ? 100.0 * isrTotal / AwakeCycles : 0.0);
+  printf("   worst ISR incl. entry/exit %llu cycles (%.1f us), budget %u per 125 us tick, %u overran their period\n",
+    (unsigned long long)isrMax, isrMax / 4.0, TICK_BUDGET_CYCLES, IsrOverruns);
+
+  printf("   %-28s %4s %9s %9s %7s %12s\n", "function (cycles)", "ctx", "calls", "avg", "max", "total");
+  for (i = 0; i < FuncCount; i++)
+  {
+    printf("   %-28s %4s %9u %9.1f %7llu %12llu\n",
+      SimFunctionName(Funcs[i].Fn), Funcs[i].Context ? "isr" : "main", Funcs[i].Calls,
+      Funcs[i].Total / (double)Funcs[i].Calls, (unsigned long long)Funcs[i].Max,
+      (unsigned long long)Funcs[i].Total);
+  }
+
+  printf("   LED on-time (%% of awake):");
+  for (i = 0; i < 8; i++)
+  {
+    printf(" %s %.1f%s", LEDs[i].Name, AwakeCycles ? 100.0 * LEDOnCycles[i] / AwakeCycles : 0.0,
+      (i < 7) ? "," : "\n");
+  }
+  printf("   ghosts (lit < %u cycles):", GHOST_CYCLES);
+  for (i = 0; i < 8; i++)
+  {
+    printf(" %s %u%s", LEDs[i].Name, GhostCount[i], (i < 7) ? "," : "\n");
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  const char * name = "custom";
+  long limitMs = -1;
+  int arg = 1;
+  size_t i;
+
+  while (arg + 1 < argc && argv[arg][0] == '-')
+  {
+    if (strcmp(argv[arg], "-t") == 0)
+    {
+      limitMs = atol(argv[arg + 1]);
+    }
+    else if (strcmp(argv[arg], "-p") == 0)
+    {
+      TraceCycle = (uint64_t)atol(argv[arg + 1]) * CYCLES_PER_MS;
+    }
+    else
+    {
+      break;
+    }
+    arg += 2;
+  }
+  if (arg >= argc)
+  {
+    fprintf(stderr, "usage: ltsim [-t ms] [-p ms] <scenario | event...>\n   scenarios:");
+    for (i = 0; i < sizeof(Scenarios) / sizeof(Scenarios[0]); i++)
+    {
+      fprintf(stderr, " %s", Scenarios[i].Name);
+    }
+    fprintf(stderr, "\n");
+    return 2;
+  }
+
+  for (i = 0; i < sizeof(Scenarios) / sizeof(Scenarios[0]); i++)
+  {
+    if (strcmp(argv[arg], Scenarios[i].Name) == 0)
+    {
+      name = Scenarios[i].Name;
+      SimParseEvents(Scenarios[i].Events);
+      break;
+    }
+  }
+  if (i == sizeof(Scenarios) / sizeof(Scenarios[0]))
+  {
+    for (; arg < argc; arg++)
+    {
+      SimParseEvent(argv[arg]);
+    }
+  }
+  qsort(Events, EventCount, sizeof(Event_t), SimCompareEvents);
+
+  if (limitMs >= 0)
+  {
+    StopCycle = (uint64_t)limitMs * CYCLES_PER_MS;
+  }
+  else
+  {
+    StopCycle = (EventCount ? Events[EventCount - 1].Cycle : 0) + 2000 * CYCLES_PER_MS;
+  }
+
+  if (setjmp(SimExit) == 0)
+  {
+    firmware_main();
+    ExitReason = "main returned";
+  }
+
+  SimReport(name);
+  return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * Learn To Solder 2018 host simulator - mock <xc.h>
+ *
+ * Stands in for the XC8 device header when main.c and the MCC drivers are
+ * built for Linux. Only the PIC12F1572 registers the firmware actually
+ * touches are modelled. The register storage and all of the behaviour
+ * (pin levels, TMR0, interrupts, sleep) lives in sim.c.
+ *
+ * Copyright 2018
+ * All of this code is in the public domain
+ */
+
+#ifndef SIM_XC_H
+#define SIM_XC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// XC8 qualifiers that mean nothing on the host. The 'interrupt' keyword is
+// defined on the compiler command line, since interrupt_manager.h uses it
+// before it pulls this header in.
+#define __at(x)
+
+typedef union {
+  struct {
+    unsigned RA0 : 1;
+    unsigned RA1 : 1;
+    unsigned RA2 : 1;
+    unsigned RA3 : 1;
+    unsigned RA4 : 1;
+    unsigned RA5 : 1;
+  };
+  uint8_t reg;
+} PORTAbits_t;
+
+typedef union {
+  struct {
+    unsigned LATA0 : 1;
+    unsigned LATA1 : 1;
+    unsigned LATA2 : 1;
+    unsigned LATA3 : 1;
+    unsigned LATA4 : 1;
+    unsigned LATA5 : 1;
+  };
+  uint8_t reg;
+} LATAbits_t;
+
+typedef union {
+  struct {
+    unsigned TRISA0 : 1;
+    unsigned TRISA1 : 1;
+    unsigned TRISA2 : 1;
+    unsigned TRISA3 : 1;
+    unsigned TRISA4 : 1;
+    unsigned TRISA5 : 1;
+  };
+  uint8_t reg;
+} TRISAbits_t;
+
+typedef union {
+  struct {
+    unsigned IOCIF  : 1;
+    unsigned INTF   : 1;
+    unsigned TMR0IF : 1;
+    unsigned IOCIE  : 1;
+    unsigned INTE   : 1;
+    unsigned TMR0IE : 1;
+    unsigned PEIE   : 1;
+    unsigned GIE    : 1;
+  };
+  uint8_t reg;
+} INTCONbits_t;
+
+typedef union {
+  struct {
+    unsigned PS     : 3;
+    unsigned PSA    : 1;
+    unsigned TMR0SE : 1;
+    unsigned TMR0CS : 1;
+    unsigned INTEDG : 1;
+    unsigned nWPUEN : 1;
+  };
+  uint8_t reg;
+} OPTION_REGbits_t;
+
+typedef union {
+  struct {
+    unsigned VREGPR : 1;
+    unsigned VREGPM : 1;
+  };
+  uint8_t reg;
+} VREGCONbits_t;
+
+typedef union {
+  struct {
+    unsigned IOCAF0 : 1;
+    unsigned IOCAF1 : 1;
+    unsigned IOCAF2 : 1;
+    unsigned IOCAF3 : 1;
+    unsigned IOCAF4 : 1;
+    unsigned IOCAF5 : 1;
+  };
+  uint8_t reg;
+} IOCAFbits_t;
+
+typedef union {
+  struct {
+    unsigned IOCAN0 : 1;
+    unsigned IOCAN1 : 1;
+    unsigned IOCAN2 : 1;
+    unsigned IOCAN3 : 1;
+    unsigned IOCAN4 : 1;
+    unsigned IOCAN5 : 1;
+  };
+  uint8_t reg;
+} IOCANbits_t;
+
+typedef union {
+  struct {
+    unsigned IOCAP0 : 1;
+    unsigned IOCAP1 : 1;
+    unsigned IOCAP2 : 1;
+    unsigned IOCAP3 : 1;
+    unsigned IOCAP4 : 1;
+    unsigned IOCAP5 : 1;
+  };
+  uint8_t reg;
+} IOCAPbits_t;
+
+typedef union {
+  struct {
+    unsigned WPUA0 : 1;
+    unsigned WPUA1 : 1;
+    unsigned WPUA2 : 1;
+    unsigned WPUA3 : 1;
+    unsigned WPUA4 : 1;
+    unsigned WPUA5 : 1;
+  };
+  uint8_t reg;
+} WPUAbits_t;
+
+typedef union {
+  struct {
+    unsigned ANSA0 : 1;
+    unsigned ANSA1 : 1;
+    unsigned ANSA2 : 1;
+    unsigned       : 1;
+    unsigned ANSA4 : 1;
+  };
+  uint8_t reg;
+} ANSELAbits_t;
+
+typedef union {
+  struct {
+    unsigned ODA0 : 1;
+    unsigned ODA1 : 1;
+    unsigned ODA2 : 1;
+    unsigned      : 1;
+    unsigned ODA4 : 1;
+    unsigned ODA5 : 1;
+  };
+  uint8_t reg;
+} ODCONAbits_t;
+
+extern volatile PORTAbits_t       PORTAbits;
+extern volatile LATAbits_t        LATAbits;
+extern volatile TRISAbits_t       TRISAbits;
+extern volatile INTCONbits_t      INTCONbits;
+extern volatile OPTION_REGbits_t  OPTION_REGbits;
+extern volatile VREGCONbits_t     VREGCONbits;
+extern volatile IOCAFbits_t       IOCAFbits;
+extern volatile IOCANbits_t       IOCANbits;
+extern volatile IOCAPbits_t       IOCAPbits;
+extern volatile WPUAbits_t        WPUAbits;
+extern volatile ANSELAbits_t      ANSELAbits;
+extern volatile ODCONAbits_t      ODCONAbits;
+
+// Whole-register names alias the same storage as the bit structures, like
+// the real device header does with two symbols at one address. Firmware
+// accesses to the LED pin registers go through SimPinRegister() first, so
+// the simulator sees every pin state, even ones that last no time at all.
+#ifdef SIM_INTERNAL
+#define PORTA       (PORTAbits.reg)
+#define LATA        (LATAbits.reg)
+#define TRISA       (TRISAbits.reg)
+#else
+#define PORTA       (*SimPinRegister(&PORTAbits.reg))
+#define LATA        (*SimPinRegister(&LATAbits.reg))
+#define TRISA       (*SimPinRegister(&TRISAbits.reg))
+#endif
+#define INTCON      (INTCONbits.reg)
+#define OPTION_REG  (OPTION_REGbits.reg)
+#define VREGCON     (VREGCONbits.reg)
+#define IOCAF       (IOCAFbits.reg)
+#define IOCAN       (IOCANbits.reg)
+#define IOCAP       (IOCAPbits.reg)
+#define WPUA        (WPUAbits.reg)
+#define ANSELA      (ANSELAbits.reg)
+#define ODCONA      (ODCONAbits.reg)
+
+extern volatile uint8_t TMR0;
+extern volatile uint8_t OSCCON;
+extern volatile uint8_t OSCTUNE;
+extern volatile uint8_t BORCON;
+extern volatile uint8_t WDTCON;
+extern volatile uint8_t APFCON;
+
+// Core instructions and delay builtins, all of which burn simulated time
+void SimSleep(void);
+void SimDelayCycles(uint32_t cycles);
+volatile uint8_t * SimPinRegister(volatile uint8_t * Reg);
+
+#define SLEEP()         SimSleep()
+#define NOP()           SimDelayCycles(1)
+#define CLRWDT()        SimDelayCycles(1)
+#define ei()            (INTCONbits.GIE = 1)
+#define di()            (INTCONbits.GIE = 0)
+
+#define _delay(x)       SimDelayCycles(x)
+#define __delay_ms(x)   SimDelayCycles((uint32_t)((x) * (_XTAL_FREQ / 4000UL)))
+#define __delay_us(x)   SimDelayCycles((uint32_t)((x) * (_XTAL_FREQ / 4000000UL)))
+
+#endif // SIM_XC_H